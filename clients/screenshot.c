@@ -47,9 +47,7 @@ int buffer_copy_done;
 
 struct screenshooter_output {
 	struct wl_output *output;
-	struct wl_buffer *buffer;
 	int width, height, offset_x, offset_y;
-	void *data;
 	struct wl_list link;
 };
 
@@ -162,40 +160,15 @@ create_shm_buffer(int width, int height, void **data_out)
 }
 
 static void
-write_png(int width, int height)
+write_png(int width, int height, void *data)
 {
-	int output_stride, buffer_stride, i;
 	cairo_surface_t *surface;
-	void *data, *d, *s;
-	struct screenshooter_output *output, *next;
-
-	buffer_stride = width * 4;
-
-	data = malloc(buffer_stride * height);
-	if (!data)
-		return;
-
-	wl_list_for_each_safe(output, next, &output_list, link) {
-		output_stride = output->width * 4;
-		s = output->data;
-		d = data + (output->offset_y - min_y) * buffer_stride +
-			   (output->offset_x - min_x) * 4;
-
-		for (i = 0; i < output->height; i++) {
-			memcpy(d, s, output_stride);
-			d += buffer_stride;
-			s += output_stride;
-		}
-
-		free(output);
-	}
 
 	surface = cairo_image_surface_create_for_data(data,
 						      CAIRO_FORMAT_ARGB32,
-						      width, height, buffer_stride);
+						      width, height, width * 4);
 	cairo_surface_write_to_png(surface, "wayland-screenshot.png");
 	cairo_surface_destroy(surface);
-	free(data);
 }
 
 static int
@@ -224,8 +197,9 @@ set_buffer_size(int *width, int *height)
 int main(int argc, char *argv[])
 {
 	struct wl_display *display;
-	struct screenshooter_output *output;
+	struct wl_buffer *buffer;
 	int width, height;
+	void *data;
 
 	display = wl_display_connect(NULL);
 	if (display == NULL) {
@@ -248,15 +222,20 @@ int main(int argc, char *argv[])
 		return -1;
 
 
-	wl_list_for_each(output, &output_list, link) {
-		output->buffer = create_shm_buffer(output->width, output->height, &output->data);
-		screenshooter_shoot(screenshooter, output->output, output->buffer);
-		buffer_copy_done = 0;
-		while (!buffer_copy_done)
-			wl_display_roundtrip(display);
-	}
+	/* Grab the whole desktop in one go; the compositor copies each
+	 * output straight into its part of the buffer. */
+	buffer = create_shm_buffer(width, height, &data);
+	if (buffer == NULL)
+		return -1;
+
+	memset(data, 0, width * 4 * height);
+	screenshooter_shoot_region(screenshooter, buffer,
+				   min_x, min_y, width, height);
+	buffer_copy_done = 0;
+	while (!buffer_copy_done)
+		wl_display_roundtrip(display);
 
-	write_png(width, height);
+	write_png(width, height, data);
 
 	return 0;
 }
@@ -23,13 +23,20 @@
 
 #define _GNU_SOURCE
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <linux/input.h>
 #include <assert.h>
+#include <time.h>
+#include <sys/mman.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -43,7 +50,47 @@
 #include "launcher-util.h"
 #include "log.h"
 
+#ifdef HAVE_DRM_ATOMIC
+#ifndef DRM_PLANE_TYPE_OVERLAY
+#define DRM_PLANE_TYPE_OVERLAY 0
+#define DRM_PLANE_TYPE_PRIMARY 1
+#define DRM_PLANE_TYPE_CURSOR 2
+#endif
+#endif
+
+#ifndef DRM_CAP_TIMESTAMP_MONOTONIC
+#define DRM_CAP_TIMESTAMP_MONOTONIC 0x6
+#endif
+
+#ifndef DRM_CAP_CURSOR_WIDTH
+#define DRM_CAP_CURSOR_WIDTH 0x8
+#endif
+
+#ifndef DRM_CAP_CURSOR_HEIGHT
+#define DRM_CAP_CURSOR_HEIGHT 0x9
+#endif
+
 static int option_current_mode = 0;
+static int option_dumb_buffers = 0;
+static char *option_record_input = NULL;
+static char *option_replay_input = NULL;
+static int option_replay_speed = 1;
+
+/* Plane properties used by atomic commits, in the order of
+ * drm_plane_prop_names. */
+enum drm_plane_prop {
+	DRM_PLANE_FB_ID,
+	DRM_PLANE_CRTC_ID,
+	DRM_PLANE_SRC_X,
+	DRM_PLANE_SRC_Y,
+	DRM_PLANE_SRC_W,
+	DRM_PLANE_SRC_H,
+	DRM_PLANE_CRTC_X,
+	DRM_PLANE_CRTC_Y,
+	DRM_PLANE_CRTC_W,
+	DRM_PLANE_CRTC_H,
+	DRM_PLANE_PROP_COUNT
+};
 
 enum {
 	WESTON_PLANE_DRM_CURSOR = 0x100
@@ -74,6 +121,16 @@ struct drm_compositor {
 
 	struct wl_list sprite_list;
 	int sprites_are_broken;
+	int atomic_modeset;
+
+	int32_t cursor_width, cursor_height;
+
+	/* The clock of page flip and vblank timestamps */
+	clockid_t clock;
+
+	/* Outputs whose frame completed in the current batch of DRM
+	 * events, see drm_compositor_finish_frames(). */
+	struct wl_list finished_list;
 
 	uint32_t prev_state;
 };
@@ -85,6 +142,13 @@ struct drm_mode {
 
 struct drm_output;
 
+/*
+ * Framebuffers of the gbm surface an output renders to belong to their
+ * bo.  Framebuffers of client buffers are kept for as long as the
+ * buffer exists, see drm_fb_get_from_buffer(), and counted: every
+ * plane that shows the buffer or is about to holds a reference.
+ * Dumb buffer framebuffers belong to their output.
+ */
 struct drm_fb {
 	struct gbm_bo *bo;
 	struct drm_output *output;
@@ -92,6 +156,29 @@ struct drm_fb {
 	int is_client_buffer;
 	struct wl_buffer *buffer;
 	struct wl_listener buffer_destroy_listener;
+
+	struct drm_compositor *compositor;
+	uint32_t format;
+	int is_view;		/* format differs from the buffer's */
+	int refcount;
+
+	/* Dumb buffers only */
+	int is_dumb;
+	uint32_t handle, stride, size;
+	void *map;
+};
+
+/* With --use-dumb-buffers an output is drawn into a texture and the
+ * damage copied from there to the dumb buffer flipped next, fb[back].
+ * While a client buffer is
+ * scanned out directly neither the texture nor the dumb buffers are
+ * updated, so they are marked stale and redrawn in full after. */
+struct drm_dumb_target {
+	struct drm_fb *fb[2];
+	int back;
+	int fb_stale[2];
+	int texture_stale;
+	struct weston_texture_target target;
 };
 
 struct drm_output {
@@ -105,11 +192,37 @@ struct drm_output {
 	int page_flip_pending;
 
 	struct gbm_surface *surface;
+	/* The cursor image shown is cursor_bo[current_cursor], and a
+	 * copy of it is kept in cursor_image[current_cursor] so that
+	 * unchanged images are not written again. */
 	struct gbm_bo *cursor_bo[2];
+	uint32_t *cursor_image[2];
 	int current_cursor;
+	int32_t cursor_width, cursor_height;
+	struct wl_buffer *cursor_buffer;
+	struct wl_listener cursor_buffer_destroy_listener;
+	uint32_t cursor_serial;		/* content_serial of the image */
+	struct weston_surface *cursor_surface;
+	int32_t cursor_x, cursor_y;
 	EGLSurface egl_surface;
 	struct drm_fb *current, *next;
 	struct backlight *backlight;
+
+	struct drm_dumb_target dumb;
+
+	/* Frame timing, in microseconds of drm_compositor::clock.  The
+	 * deadline is the vblank after the last flip. */
+	struct wl_list finished_link;
+	int frame_finished;
+	uint64_t submit_us, flip_us, deadline_us;
+	uint32_t frames, missed_vblanks;
+
+	/* Objects and properties for atomic commits */
+	uint32_t primary_plane_id;
+	uint32_t primary_props[DRM_PLANE_PROP_COUNT];
+	uint32_t crtc_active_prop;
+	uint32_t crtc_mode_id_prop;
+	uint32_t connector_crtc_id_prop;
 };
 
 /*
@@ -119,8 +232,8 @@ struct drm_output {
 struct drm_sprite {
 	struct wl_list link;
 
-	uint32_t fb_id;
-	uint32_t pending_fb_id;
+	struct drm_fb *fb;
+	struct drm_fb *pending_fb;
 	struct weston_surface *surface;
 	struct weston_surface *pending_surface;
 
@@ -133,6 +246,7 @@ struct drm_sprite {
 
 	uint32_t possible_crtcs;
 	uint32_t plane_id;
+	uint32_t props[DRM_PLANE_PROP_COUNT];
 	uint32_t count_formats;
 
 	int32_t src_x, src_y;
@@ -183,11 +297,6 @@ drm_fb_destroy_callback(struct gbm_bo *bo, void *data)
 	if (fb->fb_id)
 		drmModeRmFB(gbm_device_get_fd(gbm), fb->fb_id);
 
-	if (fb->buffer) {
-		weston_buffer_post_release(fb->buffer);
-		wl_list_remove(&fb->buffer_destroy_listener.link);
-	}
-
 	free(data);
 }
 
@@ -204,11 +313,13 @@ drm_fb_get_from_bo(struct gbm_bo *bo, struct drm_output *output)
 		return fb;
 
 	fb = malloc(sizeof *fb);
+	if (fb == NULL)
+		return NULL;
 
+	memset(fb, 0, sizeof *fb);
 	fb->bo = bo;
 	fb->output = output;
-	fb->is_client_buffer = 0;
-	fb->buffer = NULL;
+	fb->compositor = compositor;
 
 	width = gbm_bo_get_width(bo);
 	height = gbm_bo_get_height(bo);
@@ -228,6 +339,14 @@ drm_fb_get_from_bo(struct gbm_bo *bo, struct drm_output *output)
 	return fb;
 }
 
+static void
+drm_fb_destroy_client(struct drm_fb *fb)
+{
+	drmModeRmFB(fb->compositor->drm.fd, fb->fb_id);
+	gbm_bo_destroy(fb->bo);
+	free(fb);
+}
+
 static void
 fb_handle_buffer_destroy(struct wl_listener *listener, void *data)
 {
@@ -236,9 +355,293 @@ fb_handle_buffer_destroy(struct wl_listener *listener, void *data)
 
 	fb->buffer = NULL;
 
-	if (fb == fb->output->next ||
-	    (fb == fb->output->current && !fb->output->next))
-		weston_output_schedule_repaint(&fb->output->base);
+	/* A framebuffer still on a plane goes away with the last
+	 * reference; repaint so that happens soon. */
+	if (fb->refcount == 0)
+		drm_fb_destroy_client(fb);
+	else
+		weston_compositor_schedule_repaint(&fb->compositor->base);
+}
+
+/* Returns the framebuffer for the buffer attached to es.  It is created
+ * the first time the buffer is seen and destroyed with the buffer, so
+ * that buffers a client cycles through are only added to KMS once.
+ *
+ * The framebuffer has the format of the buffer, unless format is
+ * given: then it is a view of the buffer in that format, which has to
+ * have the same layout, such as XRGB8888 for an ARGB8888 buffer. */
+static struct drm_fb *
+drm_fb_get_from_buffer(struct drm_compositor *c, struct weston_surface *es,
+		       uint32_t format)
+{
+	struct wl_signal *signal = &es->buffer->resource.destroy_signal;
+	struct wl_listener *listener;
+	struct drm_fb *fb;
+	uint32_t handles[4], pitches[4], offsets[4];
+	int ret;
+
+	wl_list_for_each(listener, &signal->listener_list, link) {
+		if (listener->notify != fb_handle_buffer_destroy)
+			continue;
+
+		fb = container_of(listener, struct drm_fb,
+				  buffer_destroy_listener);
+		if (format ? fb->format == format : !fb->is_view)
+			return fb;
+	}
+
+	fb = malloc(sizeof *fb);
+	if (fb == NULL)
+		return NULL;
+
+	memset(fb, 0, sizeof *fb);
+	fb->bo = gbm_bo_create_from_egl_image(c->gbm, c->base.egl_display,
+					      es->image, es->buffer->width,
+					      es->buffer->height,
+					      GBM_BO_USE_SCANOUT);
+	if (fb->bo == NULL) {
+		free(fb);
+		return NULL;
+	}
+
+	fb->format = gbm_bo_get_format(fb->bo);
+	if (format && format != fb->format) {
+		fb->format = format;
+		fb->is_view = 1;
+	}
+
+	handles[0] = gbm_bo_get_handle(fb->bo).u32;
+	pitches[0] = gbm_bo_get_pitch(fb->bo);
+	offsets[0] = 0;
+
+	ret = drmModeAddFB2(c->drm.fd, es->buffer->width, es->buffer->height,
+			    fb->format, handles, pitches, offsets,
+			    &fb->fb_id, 0);
+	if (ret) {
+		weston_log("addfb2 failed: %d\n", ret);
+		gbm_bo_destroy(fb->bo);
+		free(fb);
+		return NULL;
+	}
+
+	fb->compositor = c;
+	fb->is_client_buffer = 1;
+	fb->buffer = es->buffer;
+	fb->buffer_destroy_listener.notify = fb_handle_buffer_destroy;
+	wl_signal_add(signal, &fb->buffer_destroy_listener);
+
+	return fb;
+}
+
+/* Take a reference for a plane that is going to show the buffer. */
+static struct drm_fb *
+drm_fb_ref(struct drm_fb *fb)
+{
+	fb->refcount++;
+	fb->buffer->busy_count++;
+
+	return fb;
+}
+
+static void
+drm_fb_unref(struct drm_fb *fb)
+{
+	if (fb->buffer)
+		weston_buffer_post_release(fb->buffer);
+
+	if (--fb->refcount == 0 && fb->buffer == NULL)
+		drm_fb_destroy_client(fb);
+}
+
+/* Release the framebuffer a primary plane no longer shows. */
+static void
+drm_output_release_fb(struct drm_output *output, struct drm_fb *fb)
+{
+	if (fb->is_client_buffer)
+		drm_fb_unref(fb);
+	else if (!fb->is_dumb)
+		gbm_surface_release_buffer(output->surface, fb->bo);
+}
+
+static struct drm_fb *
+drm_fb_create_dumb(struct drm_compositor *ec, int width, int height)
+{
+	struct drm_fb *fb;
+	struct drm_mode_create_dumb create_arg;
+	struct drm_mode_destroy_dumb destroy_arg;
+	struct drm_mode_map_dumb map_arg;
+	int ret;
+
+	fb = malloc(sizeof *fb);
+	if (fb == NULL)
+		return NULL;
+
+	memset(fb, 0, sizeof *fb);
+	fb->compositor = ec;
+	fb->format = GBM_FORMAT_XRGB8888;
+	fb->is_dumb = 1;
+
+	memset(&create_arg, 0, sizeof create_arg);
+	create_arg.bpp = 32;
+	create_arg.width = width;
+	create_arg.height = height;
+
+	ret = drmIoctl(ec->drm.fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_arg);
+	if (ret)
+		goto err_fb;
+
+	fb->handle = create_arg.handle;
+	fb->stride = create_arg.pitch;
+	fb->size = create_arg.size;
+
+	ret = drmModeAddFB(ec->drm.fd, width, height, 24, 32,
+			   fb->stride, fb->handle, &fb->fb_id);
+	if (ret)
+		goto err_bo;
+
+	memset(&map_arg, 0, sizeof map_arg);
+	map_arg.handle = fb->handle;
+	ret = drmIoctl(ec->drm.fd, DRM_IOCTL_MODE_MAP_DUMB, &map_arg);
+	if (ret)
+		goto err_add_fb;
+
+	fb->map = mmap(0, fb->size, PROT_WRITE, MAP_SHARED,
+		       ec->drm.fd, map_arg.offset);
+	if (fb->map == MAP_FAILED)
+		goto err_add_fb;
+
+	return fb;
+
+err_add_fb:
+	drmModeRmFB(ec->drm.fd, fb->fb_id);
+err_bo:
+	memset(&destroy_arg, 0, sizeof destroy_arg);
+	destroy_arg.handle = create_arg.handle;
+	drmIoctl(ec->drm.fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_arg);
+err_fb:
+	weston_log("failed to create dumb buffer: %m\n");
+	free(fb);
+	return NULL;
+}
+
+static void
+drm_fb_destroy_dumb(struct drm_fb *fb)
+{
+	struct drm_mode_destroy_dumb destroy_arg;
+
+	munmap(fb->map, fb->size);
+	drmModeRmFB(fb->compositor->drm.fd, fb->fb_id);
+
+	memset(&destroy_arg, 0, sizeof destroy_arg);
+	destroy_arg.handle = fb->handle;
+	drmIoctl(fb->compositor->drm.fd, DRM_IOCTL_MODE_DESTROY_DUMB,
+		 &destroy_arg);
+
+	free(fb);
+}
+
+static void
+drm_dumb_target_fini(struct drm_dumb_target *d)
+{
+	int i;
+
+	for (i = 0; i < 2; i++)
+		if (d->fb[i])
+			drm_fb_destroy_dumb(d->fb[i]);
+
+	weston_texture_target_fini(&d->target);
+	memset(d, 0, sizeof *d);
+}
+
+/* The renderer is GL, but it needs neither a GPU nor scanout capable
+ * gbm buffers: the output is drawn into a texture and the damaged
+ * parts are copied to a pair of dumb buffers that are flipped like
+ * gbm ones. */
+static int
+drm_dumb_target_init(struct drm_compositor *ec, struct drm_dumb_target *d,
+		     int width, int height)
+{
+	int i;
+
+	memset(d, 0, sizeof *d);
+
+	for (i = 0; i < 2; i++) {
+		d->fb[i] = drm_fb_create_dumb(ec, width, height);
+		if (d->fb[i] == NULL)
+			goto err;
+	}
+
+	if (!eglMakeCurrent(ec->base.egl_display, ec->dummy_egl_surface,
+			    ec->dummy_egl_surface, ec->base.egl_context)) {
+		weston_log("failed to make current\n");
+		goto err;
+	}
+
+	if (weston_texture_target_init(&d->target, width, height) < 0)
+		goto err;
+
+	return 0;
+
+err:
+	drm_dumb_target_fini(d);
+	return -1;
+}
+
+/* Copy the damaged rectangles from the output texture to fb.  fb was
+ * shown two frames ago, and the damage passed to repaint covers both
+ * frames since, so that brings it up to date. */
+static void
+drm_output_copy_damage(struct drm_output *output, struct drm_fb *fb,
+		       pixman_region32_t *damage)
+{
+	pixman_region32_t region;
+
+	pixman_region32_init(&region);
+	pixman_region32_copy(&region, damage);
+	pixman_region32_translate(&region,
+				  -output->base.x, -output->base.y);
+
+	weston_texture_target_read(output->base.compositor,
+				   &output->dumb.target, &region,
+				   fb->map, fb->stride);
+
+	pixman_region32_fini(&region);
+}
+
+static void
+drm_output_render_dumb(struct drm_output *output, pixman_region32_t *damage)
+{
+	struct drm_compositor *compositor =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_dumb_target *d = &output->dumb;
+	struct weston_surface *surface;
+	struct drm_fb *fb = d->fb[d->back];
+	pixman_region32_t *repaint;
+
+	if (!eglMakeCurrent(compositor->base.egl_display,
+			    compositor->dummy_egl_surface,
+			    compositor->dummy_egl_surface,
+			    compositor->base.egl_context)) {
+		weston_log("failed to make current\n");
+		return;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, d->target.fbo);
+
+	repaint = d->texture_stale ? &output->base.region : damage;
+	wl_list_for_each_reverse(surface, &compositor->base.surface_list, link)
+		weston_surface_draw(surface, &output->base, repaint);
+	d->texture_stale = 0;
+
+	wl_signal_emit(&output->base.frame_signal, output);
+
+	repaint = d->fb_stale[d->back] ? &output->base.region : damage;
+	drm_output_copy_damage(output, fb, repaint);
+	d->fb_stale[d->back] = 0;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	output->dumb.back ^= 1;
+	output->next = fb;
 }
 
 static int
@@ -247,7 +650,7 @@ drm_output_prepare_scanout_surface(struct drm_output *output)
 	struct drm_compositor *c =
 		(struct drm_compositor *) output->base.compositor;
 	struct weston_surface *es;
-	struct gbm_bo *bo;
+	struct drm_fb *fb;
 
 	es = container_of(c->base.surface_list.next,
 			  struct weston_surface, link);
@@ -257,41 +660,40 @@ drm_output_prepare_scanout_surface(struct drm_output *output)
 	    es->geometry.width != output->base.current->width ||
 	    es->geometry.height != output->base.current->height ||
 	    es->transform.enabled ||
+	    es->alpha != 1.0 ||
 	    es->image == EGL_NO_IMAGE_KHR)
 		return -1;
 
-	bo = gbm_bo_create_from_egl_image(c->gbm,
-					  c->base.egl_display,
-					  es->image,
-					  es->geometry.width,
-					  es->geometry.height,
-					  GBM_BO_USE_SCANOUT);
-
-	/* Need to verify output->region contained in surface opaque
-	 * region.  Or maybe just that format doesn't have alpha.
-	 * For now, scanout only if format is XRGB8888. */
-	if (gbm_bo_get_format(bo) != GBM_FORMAT_XRGB8888) {
-		gbm_bo_destroy(bo);
+	fb = drm_fb_get_from_buffer(c, es, 0);
+	if (fb == NULL)
 		return -1;
-	}
 
-	output->next = drm_fb_get_from_bo(bo, output);
-	if (!output->next) {
-		gbm_bo_destroy(bo);
+	/* Most clients render to ARGB8888 even when they draw nothing
+	 * translucent.  If the surface is opaque over the whole output,
+	 * or only black shows through, the alpha channel makes no
+	 * difference and the buffer can be scanned out as XRGB8888:
+	 * buffers are premultiplied, so a pixel over black is just its
+	 * color channels. */
+	if (fb->format == GBM_FORMAT_ARGB8888 &&
+	    (pixman_region32_contains_rectangle(&es->transform.opaque,
+			pixman_region32_extents(&output->base.region)) ==
+	     PIXMAN_REGION_IN || weston_output_black_below(&output->base, es)))
+		fb = drm_fb_get_from_buffer(c, es, GBM_FORMAT_XRGB8888);
+
+	if (fb == NULL || fb->format != GBM_FORMAT_XRGB8888)
 		return -1;
-	}
-
-	output->next->is_client_buffer = 1;
-	output->next->buffer = es->buffer;
-	output->next->buffer->busy_count++;
-	output->next->buffer_destroy_listener.notify = fb_handle_buffer_destroy;
 
-	wl_signal_add(&output->next->buffer->resource.destroy_signal,
-		      &output->next->buffer_destroy_listener);
+	output->next = drm_fb_ref(fb);
 
 	pixman_region32_fini(&es->damage);
 	pixman_region32_init(&es->damage);
 
+	if (option_dumb_buffers) {
+		output->dumb.texture_stale = 1;
+		output->dumb.fb_stale[0] = 1;
+		output->dumb.fb_stale[1] = 1;
+	}
+
 	return 0;
 }
 
@@ -303,6 +705,11 @@ drm_output_render(struct drm_output *output, pixman_region32_t *damage)
 	struct weston_surface *surface;
 	struct gbm_bo *bo;
 
+	if (option_dumb_buffers) {
+		drm_output_render_dumb(output, damage);
+		return;
+	}
+
 	if (!eglMakeCurrent(compositor->base.egl_display, output->egl_surface,
 			    output->egl_surface,
 			    compositor->base.egl_context)) {
@@ -330,6 +737,289 @@ drm_output_render(struct drm_output *output, pixman_region32_t *damage)
 	}
 }
 
+#ifdef HAVE_DRM_ATOMIC
+static const char *drm_plane_prop_names[DRM_PLANE_PROP_COUNT] = {
+	[DRM_PLANE_FB_ID] = "FB_ID",
+	[DRM_PLANE_CRTC_ID] = "CRTC_ID",
+	[DRM_PLANE_SRC_X] = "SRC_X",
+	[DRM_PLANE_SRC_Y] = "SRC_Y",
+	[DRM_PLANE_SRC_W] = "SRC_W",
+	[DRM_PLANE_SRC_H] = "SRC_H",
+	[DRM_PLANE_CRTC_X] = "CRTC_X",
+	[DRM_PLANE_CRTC_Y] = "CRTC_Y",
+	[DRM_PLANE_CRTC_W] = "CRTC_W",
+	[DRM_PLANE_CRTC_H] = "CRTC_H",
+};
+
+/* Look up a property of a KMS object by name.  Returns -1 if the
+ * object has no such property. */
+static int
+drm_property_get(int fd, uint32_t object_id, uint32_t object_type,
+		 const char *name, uint32_t *id, uint64_t *value)
+{
+	drmModeObjectProperties *props;
+	drmModePropertyRes *prop;
+	uint32_t i;
+	int ret = -1;
+
+	props = drmModeObjectGetProperties(fd, object_id, object_type);
+	if (props == NULL)
+		return -1;
+
+	for (i = 0; i < props->count_props && ret < 0; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (prop == NULL)
+			continue;
+
+		if (strcmp(prop->name, name) == 0) {
+			if (id)
+				*id = prop->prop_id;
+			if (value)
+				*value = props->prop_values[i];
+			ret = 0;
+		}
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+
+	return ret;
+}
+
+static int
+drm_plane_get_props(int fd, uint32_t plane_id, uint32_t *props)
+{
+	int i;
+
+	for (i = 0; i < DRM_PLANE_PROP_COUNT; i++)
+		if (drm_property_get(fd, plane_id, DRM_MODE_OBJECT_PLANE,
+				     drm_plane_prop_names[i],
+				     &props[i], NULL) < 0)
+			return -1;
+
+	return 0;
+}
+
+static void
+drm_atomic_add_plane(drmModeAtomicReq *req,
+		     uint32_t plane_id, const uint32_t *props,
+		     uint32_t crtc_id, uint32_t fb_id,
+		     int32_t crtc_x, int32_t crtc_y,
+		     uint32_t crtc_w, uint32_t crtc_h,
+		     uint32_t src_x, uint32_t src_y,
+		     uint32_t src_w, uint32_t src_h)
+{
+	drmModeAtomicAddProperty(req, plane_id, props[DRM_PLANE_FB_ID], fb_id);
+	drmModeAtomicAddProperty(req, plane_id, props[DRM_PLANE_CRTC_ID],
+				 crtc_id);
+	drmModeAtomicAddProperty(req, plane_id, props[DRM_PLANE_SRC_X], src_x);
+	drmModeAtomicAddProperty(req, plane_id, props[DRM_PLANE_SRC_Y], src_y);
+	drmModeAtomicAddProperty(req, plane_id, props[DRM_PLANE_SRC_W], src_w);
+	drmModeAtomicAddProperty(req, plane_id, props[DRM_PLANE_SRC_H], src_h);
+	drmModeAtomicAddProperty(req, plane_id, props[DRM_PLANE_CRTC_X],
+				 crtc_x);
+	drmModeAtomicAddProperty(req, plane_id, props[DRM_PLANE_CRTC_Y],
+				 crtc_y);
+	drmModeAtomicAddProperty(req, plane_id, props[DRM_PLANE_CRTC_W],
+				 crtc_w);
+	drmModeAtomicAddProperty(req, plane_id, props[DRM_PLANE_CRTC_H],
+				 crtc_h);
+}
+
+/*
+ * Add the planes of an output to an atomic request: the primary plane
+ * showing fb_id, unless that is 0, and every sprite assigned to the
+ * output.  With disable set, sprites that the output showed but that
+ * have nothing assigned any more are turned off.
+ */
+static void
+drm_output_atomic_add_planes(struct drm_output *output,
+			     drmModeAtomicReq *req,
+			     uint32_t fb_id, int disable)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct weston_mode *mode = output->base.current;
+	struct drm_sprite *s;
+
+	if (fb_id)
+		drm_atomic_add_plane(req, output->primary_plane_id,
+				     output->primary_props,
+				     output->crtc_id, fb_id,
+				     0, 0, mode->width, mode->height,
+				     0, 0, mode->width << 16,
+				     mode->height << 16);
+
+	wl_list_for_each(s, &c->sprite_list, link) {
+		if (s->output != output)
+			continue;
+
+		if (s->pending_fb)
+			drm_atomic_add_plane(req, s->plane_id, s->props,
+					     output->crtc_id,
+					     s->pending_fb->fb_id,
+					     s->dest_x, s->dest_y,
+					     s->dest_w, s->dest_h,
+					     s->src_x, s->src_y,
+					     s->src_w, s->src_h);
+		else if (disable)
+			drm_atomic_add_plane(req, s->plane_id, s->props,
+					     0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	}
+}
+
+/* Ask the kernel whether the planes assigned to the output so far can
+ * be shown together, without changing anything. */
+static int
+drm_output_atomic_test(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	drmModeAtomicReq *req;
+	int ret;
+
+	/* Before the first commit there is no state to test against;
+	 * the commit itself falls back if it fails. */
+	if (output->current == NULL)
+		return 0;
+
+	req = drmModeAtomicAlloc();
+	if (req == NULL)
+		return -1;
+
+	drm_output_atomic_add_planes(output, req, output->current->fb_id, 0);
+	ret = drmModeAtomicCommit(c->drm.fd, req,
+				  DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+	drmModeAtomicFree(req);
+
+	return ret;
+}
+
+/* Show output->next and the sprites of the output in one non-blocking
+ * commit.  Completion is reported by a single page flip event. */
+static int
+drm_output_repaint_atomic(struct drm_output *output)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_mode *mode;
+	drmModeAtomicReq *req;
+	uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK;
+	uint32_t blob_id = 0;
+	int ret;
+
+	req = drmModeAtomicAlloc();
+	if (req == NULL)
+		return -1;
+
+	if (!output->current) {
+		mode = container_of(output->base.current,
+				    struct drm_mode, base);
+		ret = drmModeCreatePropertyBlob(c->drm.fd, &mode->mode_info,
+						sizeof mode->mode_info,
+						&blob_id);
+		if (ret) {
+			drmModeAtomicFree(req);
+			return ret;
+		}
+
+		drmModeAtomicAddProperty(req, output->crtc_id,
+					 output->crtc_mode_id_prop, blob_id);
+		drmModeAtomicAddProperty(req, output->crtc_id,
+					 output->crtc_active_prop, 1);
+		drmModeAtomicAddProperty(req, output->connector_id,
+					 output->connector_crtc_id_prop,
+					 output->crtc_id);
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	drm_output_atomic_add_planes(output, req, output->next->fb_id, 1);
+
+	ret = drmModeAtomicCommit(c->drm.fd, req, flags, output);
+	drmModeAtomicFree(req);
+	if (blob_id)
+		drmModeDestroyPropertyBlob(c->drm.fd, blob_id);
+	if (ret)
+		return ret;
+
+	output->page_flip_pending = 1;
+
+	return 0;
+}
+
+/* Find the primary plane and the properties atomic commits need.
+ * Without them the compositor uses the legacy interfaces. */
+static int
+drm_output_init_atomic(struct drm_compositor *c, struct drm_output *output)
+{
+	drmModePlaneRes *plane_res;
+	drmModePlane *plane;
+	uint64_t type;
+	uint32_t i, pipe;
+
+	for (pipe = 0; pipe < (uint32_t) c->num_crtcs; pipe++)
+		if (c->crtcs[pipe] == output->crtc_id)
+			break;
+
+	plane_res = drmModeGetPlaneResources(c->drm.fd);
+	if (!plane_res)
+		return -1;
+
+	for (i = 0; i < plane_res->count_planes; i++) {
+		plane = drmModeGetPlane(c->drm.fd, plane_res->planes[i]);
+		if (!plane)
+			continue;
+
+		if ((plane->possible_crtcs & (1 << pipe)) &&
+		    drm_property_get(c->drm.fd, plane->plane_id,
+				     DRM_MODE_OBJECT_PLANE, "type",
+				     NULL, &type) == 0 &&
+		    type == DRM_PLANE_TYPE_PRIMARY)
+			output->primary_plane_id = plane->plane_id;
+		drmModeFreePlane(plane);
+
+		if (output->primary_plane_id)
+			break;
+	}
+
+	drmModeFreePlaneResources(plane_res);
+
+	if (!output->primary_plane_id ||
+	    drm_plane_get_props(c->drm.fd, output->primary_plane_id,
+				output->primary_props) < 0 ||
+	    drm_property_get(c->drm.fd, output->crtc_id,
+			     DRM_MODE_OBJECT_CRTC, "ACTIVE",
+			     &output->crtc_active_prop, NULL) < 0 ||
+	    drm_property_get(c->drm.fd, output->crtc_id,
+			     DRM_MODE_OBJECT_CRTC, "MODE_ID",
+			     &output->crtc_mode_id_prop, NULL) < 0 ||
+	    drm_property_get(c->drm.fd, output->connector_id,
+			     DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID",
+			     &output->connector_crtc_id_prop, NULL) < 0)
+		return -1;
+
+	return 0;
+}
+#endif
+
+static uint64_t
+drm_compositor_get_time_us(struct drm_compositor *c)
+{
+	struct timespec ts;
+
+	clock_gettime(c->clock, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint64_t
+drm_output_refresh_us(struct drm_output *output)
+{
+	/* refresh is in mHz */
+	return 1000000000ULL / (output->base.current->refresh ?
+				output->base.current->refresh : 60000);
+}
+
 static void
 drm_output_repaint(struct weston_output *output_base,
 		   pixman_region32_t *damage)
@@ -347,6 +1037,19 @@ drm_output_repaint(struct weston_output *output_base,
 	if (!output->next)
 		return;
 
+	output->submit_us = drm_compositor_get_time_us(compositor);
+
+#ifdef HAVE_DRM_ATOMIC
+	if (compositor->atomic_modeset) {
+		if (drm_output_repaint_atomic(output) == 0)
+			return;
+
+		weston_log("atomic commit failed: %m, "
+			   "falling back to legacy modesetting\n");
+		compositor->atomic_modeset = 0;
+	}
+#endif
+
 	mode = container_of(output->base.current, struct drm_mode, base);
 	if (!output->current) {
 		ret = drmModeSetCrtc(compositor->drm.fd, output->crtc_id,
@@ -382,7 +1085,9 @@ drm_output_repaint(struct weston_output *output_base,
 			continue;
 
 		ret = drmModeSetPlane(compositor->drm.fd, s->plane_id,
-				      output->crtc_id, s->pending_fb_id, flags,
+				      output->crtc_id,
+				      s->pending_fb ? s->pending_fb->fb_id : 0,
+				      flags,
 				      s->dest_x, s->dest_y,
 				      s->dest_w, s->dest_h,
 				      s->src_x, s->src_y,
@@ -409,39 +1114,116 @@ drm_output_repaint(struct weston_output *output_base,
 	return;
 }
 
+/* The sprite now shows what was pending, or nothing. */
+static void
+drm_sprite_flip_done(struct drm_sprite *s)
+{
+	if (s->surface) {
+		wl_list_remove(&s->destroy_listener.link);
+		s->surface = NULL;
+	}
+
+	if (s->fb) {
+		drm_fb_unref(s->fb);
+		s->fb = NULL;
+	}
+
+	if (s->pending_surface) {
+		wl_list_remove(&s->pending_destroy_listener.link);
+		wl_signal_add(&s->pending_fb->buffer->resource.destroy_signal,
+			      &s->destroy_listener);
+		s->surface = s->pending_surface;
+		s->pending_surface = NULL;
+	}
+
+	s->fb = s->pending_fb;
+	s->pending_fb = NULL;
+}
+
+/* Convert us on the compositor clock to CLOCK_MONOTONIC. */
+static void
+drm_compositor_monotonic_time(struct drm_compositor *c, uint64_t us,
+			      struct timespec *ts)
+{
+	struct timespec mono, real;
+	int64_t t = us;
+
+	if (c->clock != CLOCK_MONOTONIC) {
+		clock_gettime(CLOCK_MONOTONIC, &mono);
+		clock_gettime(CLOCK_REALTIME, &real);
+		t += (mono.tv_sec - real.tv_sec) * 1000000LL +
+			(mono.tv_nsec - real.tv_nsec) / 1000;
+	}
+
+	ts->tv_sec = t / 1000000;
+	ts->tv_nsec = (t % 1000000) * 1000;
+}
+
+/* The frame queued at submit_us is on screen.  A flip more than a
+ * refresh period after it was queued missed at least one vblank. */
+static void
+drm_output_frame_done(struct drm_output *output,
+		      unsigned int sec, unsigned int usec)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	uint64_t refresh_us = drm_output_refresh_us(output);
+
+	output->flip_us = sec * 1000000ULL + usec;
+	output->deadline_us = output->flip_us + refresh_us;
+	drm_compositor_monotonic_time(c, output->flip_us,
+				      &output->base.presented_time);
+
+	output->frames++;
+	if (output->submit_us && output->flip_us > output->submit_us)
+		output->missed_vblanks +=
+			(output->flip_us - output->submit_us) / refresh_us;
+	output->submit_us = 0;
+
+	if (!output->frame_finished) {
+		output->frame_finished = 1;
+		wl_list_insert(c->finished_list.prev, &output->finished_link);
+	}
+}
+
+/*
+ * Repaint the outputs whose frames completed, earliest deadline
+ * first.  All CRTCs report to the same fd, so the flips of several
+ * outputs can arrive in one batch.  Repainting them in the order they
+ * come in could make a slow repaint for one output push another,
+ * faster output past its next vblank.
+ */
+static void
+drm_compositor_finish_frames(struct drm_compositor *c)
+{
+	struct drm_output *output, *first;
+
+	while (!wl_list_empty(&c->finished_list)) {
+		first = NULL;
+		wl_list_for_each(output, &c->finished_list, finished_link)
+			if (!first || output->deadline_us < first->deadline_us)
+				first = output;
+
+		wl_list_remove(&first->finished_link);
+		first->frame_finished = 0;
+		weston_output_finish_frame(&first->base,
+					   first->flip_us / 1000);
+	}
+}
+
 static void
 vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec,
 	       void *data)
 {
 	struct drm_sprite *s = (struct drm_sprite *)data;
-	struct drm_compositor *c = s->compositor;
 	struct drm_output *output = s->output;
-	uint32_t msecs;
 
 	output->vblank_pending = 0;
 
-	if (s->surface) {
-		weston_buffer_post_release(s->surface->buffer);
-		wl_list_remove(&s->destroy_listener.link);
-		s->surface = NULL;
-		drmModeRmFB(c->drm.fd, s->fb_id);
-		s->fb_id = 0;
-	}
-
-	if (s->pending_surface) {
-		wl_list_remove(&s->pending_destroy_listener.link);
-		wl_signal_add(&s->pending_surface->buffer->resource.destroy_signal,
-			      &s->destroy_listener);
-		s->surface = s->pending_surface;
-		s->pending_surface = NULL;
-		s->fb_id = s->pending_fb_id;
-		s->pending_fb_id = 0;
-	}
+	drm_sprite_flip_done(s);
 
-	if (!output->page_flip_pending) {
-		msecs = sec * 1000 + usec / 1000;
-		weston_output_finish_frame(&output->base, msecs);
-	}
+	if (!output->page_flip_pending)
+		drm_output_frame_done(output, sec, usec);
 }
 
 static void
@@ -449,25 +1231,26 @@ page_flip_handler(int fd, unsigned int frame,
 		  unsigned int sec, unsigned int usec, void *data)
 {
 	struct drm_output *output = (struct drm_output *) data;
-	uint32_t msecs;
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_sprite *s;
 
 	output->page_flip_pending = 0;
 
-	if (output->current) {
-		if (output->current->is_client_buffer)
-			gbm_bo_destroy(output->current->bo);
-		else
-			gbm_surface_release_buffer(output->surface,
-						   output->current->bo);
-	}
+	/* Atomic commits flip the sprites along with the primary plane. */
+	if (c->atomic_modeset)
+		wl_list_for_each(s, &c->sprite_list, link)
+			if (s->output == output)
+				drm_sprite_flip_done(s);
+
+	if (output->current)
+		drm_output_release_fb(output, output->current);
 
 	output->current = output->next;
 	output->next = NULL;
 
-	if (!output->vblank_pending) {
-		msecs = sec * 1000 + usec / 1000;
-		weston_output_finish_frame(&output->base, msecs);
-	}
+	if (!output->vblank_pending)
+		drm_output_frame_done(output, sec, usec);
 }
 
 static int
@@ -512,8 +1295,13 @@ drm_disable_unused_sprites(struct weston_output *output_base)
 	struct drm_sprite *s;
 	int ret;
 
+	/* Atomic commits turn off unused sprites themselves, see
+	 * drm_output_atomic_add_planes(). */
+	if (c->atomic_modeset)
+		return;
+
 	wl_list_for_each(s, &c->sprite_list, link) {
-		if (s->pending_fb_id)
+		if (s->pending_fb)
 			continue;
 
 		ret = drmModeSetPlane(c->drm.fd, s->plane_id,
@@ -522,7 +1310,11 @@ drm_disable_unused_sprites(struct weston_output *output_base)
 		if (ret)
 			weston_log("failed to disable plane: %d: %s\n",
 				ret, strerror(errno));
-		drmModeRmFB(c->drm.fd, s->fb_id);
+
+		if (s->fb) {
+			drm_fb_unref(s->fb);
+			s->fb = NULL;
+		}
 
 		if (s->surface) {
 			s->surface = NULL;
@@ -530,8 +1322,6 @@ drm_disable_unused_sprites(struct weston_output *output_base)
 		}
 
 		assert(!s->pending_surface);
-		s->fb_id = 0;
-		s->pending_fb_id = 0;
 	}
 }
 
@@ -548,15 +1338,10 @@ drm_output_prepare_overlay_surface(struct weston_output *output_base,
 	struct weston_compositor *ec = output_base->compositor;
 	struct drm_compositor *c =(struct drm_compositor *) ec;
 	struct drm_sprite *s;
+	struct drm_fb *fb;
 	int found = 0;
-	EGLint handle, stride;
-	struct gbm_bo *bo;
-	uint32_t fb_id = 0;
-	uint32_t handles[4], pitches[4], offsets[4];
-	int ret = 0;
 	pixman_region32_t dest_rect, src_rect;
 	pixman_box32_t *box;
-	uint32_t format;
 
 	if (c->sprites_are_broken)
 		return -1;
@@ -580,7 +1365,13 @@ drm_output_prepare_overlay_surface(struct weston_output *output_base,
 		if (!drm_sprite_crtc_supported(output_base, s->possible_crtcs))
 			continue;
 
-		if (!s->pending_fb_id) {
+		/* An atomic commit only touches the planes of its own
+		 * output, so a sprite still shown elsewhere is taken. */
+		if (c->atomic_modeset && s->fb &&
+		    s->output != (struct drm_output *) output_base)
+			continue;
+
+		if (!s->pending_fb) {
 			found = 1;
 			break;
 		}
@@ -590,46 +1381,21 @@ drm_output_prepare_overlay_surface(struct weston_output *output_base,
 	if (!found)
 		return -1;
 
-	bo = gbm_bo_create_from_egl_image(c->gbm, c->base.egl_display,
-					  es->image, es->geometry.width,
-					  es->geometry.height,
-					  GBM_BO_USE_SCANOUT);
-	format = gbm_bo_get_format(bo);
-	handle = gbm_bo_get_handle(bo).s32;
-	stride = gbm_bo_get_pitch(bo);
-
-	gbm_bo_destroy(bo);
-
-	if (!drm_surface_format_supported(s, format))
-		return -1;
-
-	if (!handle)
-		return -1;
-
-	handles[0] = handle;
-	pitches[0] = stride;
-	offsets[0] = 0;
-
-	ret = drmModeAddFB2(c->drm.fd, es->geometry.width, es->geometry.height,
-			    format, handles, pitches, offsets,
-			    &fb_id, 0);
-	if (ret) {
-		weston_log("addfb2 failed: %d\n", ret);
-		c->sprites_are_broken = 1;
+	/* Atomic commits are tested before they are used, so a buffer
+	 * without a framebuffer only rules out this surface.  Without
+	 * them, a failure here is taken to mean sprites don't work. */
+	fb = drm_fb_get_from_buffer(c, es, 0);
+	if (fb == NULL) {
+		if (!c->atomic_modeset)
+			c->sprites_are_broken = 1;
 		return -1;
 	}
 
-	if (s->surface && s->surface != es) {
-		struct weston_surface *old_surf = s->surface;
-		pixman_region32_fini(&old_surf->damage);
-		pixman_region32_init_rect(&old_surf->damage,
-					  old_surf->geometry.x, old_surf->geometry.y,
-					  old_surf->geometry.width, old_surf->geometry.height);
-	}
+	if (!drm_surface_format_supported(s, fb->format))
+		return -1;
 
-	s->pending_fb_id = fb_id;
+	s->pending_fb = fb;
 	s->pending_surface = es;
-	es->buffer->busy_count++;
 
 	/*
 	 * Calculate the source & dest rects properly based on actual
@@ -658,6 +1424,27 @@ drm_output_prepare_overlay_surface(struct weston_output *output_base,
 	s->src_h = (box->y2 - box->y1) << 16;
 	pixman_region32_fini(&src_rect);
 
+#ifdef HAVE_DRM_ATOMIC
+	if (c->atomic_modeset) {
+		s->output = (struct drm_output *) output_base;
+		if (drm_output_atomic_test(s->output) < 0) {
+			s->pending_fb = NULL;
+			s->pending_surface = NULL;
+			return -1;
+		}
+	}
+#endif
+
+	if (s->surface && s->surface != es) {
+		struct weston_surface *old_surf = s->surface;
+		pixman_region32_fini(&old_surf->damage);
+		pixman_region32_init_rect(&old_surf->damage,
+					  old_surf->geometry.x, old_surf->geometry.y,
+					  old_surf->geometry.width, old_surf->geometry.height);
+	}
+
+	drm_fb_ref(fb);
+
 	wl_signal_add(&es->buffer->resource.destroy_signal,
 		      &s->pending_destroy_listener);
 	return 0;
@@ -705,6 +1492,113 @@ out:
 	pixman_region32_fini(&cursor_region);
 }
 
+/* Sprites drm_assign_planes() hands out per output and repaint. */
+#define DRM_MAX_SPRITES		8
+
+/* A surface already on a sprite keeps it until another one scores this
+ * many times higher, so that sprites don't bounce between surfaces. */
+#define DRM_SPRITE_HYSTERESIS	2
+
+/* Surfaces that update less often than this per second save nothing
+ * worth a sprite. */
+#define DRM_SPRITE_MIN_UPDATES	2
+
+struct drm_plane_candidate {
+	struct weston_surface *surface;
+	uint32_t score;
+};
+
+/* The composition bandwidth, in pixels per second, that moving es to a
+ * sprite saves. */
+static uint32_t
+drm_surface_plane_score(struct drm_compositor *c, struct weston_surface *es,
+			uint32_t msecs)
+{
+	struct drm_sprite *s;
+	uint32_t score, updates;
+
+	score = weston_surface_update_rate(es, msecs, &updates);
+	if (updates < DRM_SPRITE_MIN_UPDATES)
+		score = 0;
+
+	wl_list_for_each(s, &c->sprite_list, link)
+		if (s->surface == es)
+			return score * DRM_SPRITE_HYSTERESIS + 1;
+
+	return score;
+}
+
+/* Fill candidates with the surfaces that gain most from a sprite, at
+ * most as many as there are sprites for the output, and return how
+ * many there are. */
+static int
+drm_output_pick_plane_candidates(struct weston_output *output,
+				 struct drm_plane_candidate *candidates)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->compositor;
+	struct weston_seat *seat = (struct weston_seat *) c->base.seat;
+	struct weston_surface *es;
+	struct drm_sprite *s;
+	uint32_t score, now;
+	int max = 0, count = 0, i;
+
+	wl_list_for_each(s, &c->sprite_list, link) {
+		if (!drm_sprite_crtc_supported(output, s->possible_crtcs))
+			continue;
+		if (c->atomic_modeset && s->fb &&
+		    s->output != (struct drm_output *) output)
+			continue;
+		if (max < DRM_MAX_SPRITES)
+			max++;
+	}
+
+	if (max == 0 || c->sprites_are_broken)
+		return 0;
+
+	now = weston_compositor_get_time();
+	wl_list_for_each(es, &c->base.surface_list, link) {
+		if (es == seat->sprite ||
+		    es->output_mask != (1u << output->id) ||
+		    es->image == EGL_NO_IMAGE_KHR ||
+		    surface_is_primary(&c->base, es) ||
+		    !drm_surface_transform_supported(es))
+			continue;
+
+		/* Keep the list sorted, highest score first.  Ties go to
+		 * the surface in front. */
+		score = drm_surface_plane_score(c, es, now);
+		for (i = count; i > 0; i--) {
+			if (candidates[i - 1].score >= score)
+				break;
+			if (i < max)
+				candidates[i] = candidates[i - 1];
+		}
+
+		if (i < max) {
+			candidates[i].surface = es;
+			candidates[i].score = score;
+			if (count < max)
+				count++;
+		}
+	}
+
+	return count;
+}
+
+static int
+drm_plane_candidate_find(struct drm_plane_candidate *candidates, int count,
+			 struct weston_surface *es)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (candidates[i].surface == es)
+			return 1;
+
+	return 0;
+}
+
 static void
 drm_assign_planes(struct weston_output *output)
 {
@@ -712,21 +1606,25 @@ drm_assign_planes(struct weston_output *output)
 	struct weston_surface *es, *next;
 	pixman_region32_t overlap, surface_overlap;
 	struct weston_seat *seat;
+	struct drm_plane_candidate candidates[DRM_MAX_SPRITES];
+	int count, spare = 0;
 
 	/*
-	 * Find a surface for each sprite in the output using some heuristics:
-	 * 1) size
-	 * 2) frequency of update
-	 * 3) opacity (though some hw might support alpha blending)
-	 * 4) clipping (this can be fixed with color keys)
+	 * The sprites go to the surfaces that damage the most pixels per
+	 * second, see drm_surface_plane_score().  The idea is to save on
+	 * blitting since this should save power.  If we can get a large
+	 * video surface on the sprite for example, the main display
+	 * surface may not need to update at all, and the client buffer
+	 * can be used directly for the sprite surface as we do for
+	 * flipping full screen surfaces.
 	 *
-	 * The idea is to save on blitting since this should save power.
-	 * If we can get a large video surface on the sprite for example,
-	 * the main display surface may not need to update at all, and
-	 * the client buffer can be used directly for the sprite surface
-	 * as we do for flipping full screen surfaces.
+	 * Opacity and clipping are still all or nothing: a surface that
+	 * is overlapped by anything left on the primary plane can't go
+	 * on a sprite.  A sprite that its candidate can't use is offered
+	 * to the surfaces further back.
 	 */
 	seat = (struct weston_seat *) ec->seat;
+	count = drm_output_pick_plane_candidates(output, candidates);
 	pixman_region32_init(&overlap);
 	wl_list_for_each_safe(es, next, &ec->surface_list, link) {
 		/*
@@ -744,8 +1642,20 @@ drm_assign_planes(struct weston_output *output)
 			if (seat->sprite->plane == WESTON_PLANE_PRIMARY)
 				pixman_region32_union(&overlap, &overlap,
 						      &es->transform.boundingbox);
-		} else if (!drm_output_prepare_overlay_surface(output, es,
+		} else if (drm_plane_candidate_find(candidates, count, es)) {
+			if (!drm_output_prepare_overlay_surface(output, es,
+								&surface_overlap)) {
+				pixman_region32_fini(&es->damage);
+				pixman_region32_init(&es->damage);
+			} else {
+				spare++;
+				pixman_region32_union(&overlap, &overlap,
+						      &es->transform.boundingbox);
+			}
+		} else if (spare > 0 &&
+			   !drm_output_prepare_overlay_surface(output, es,
 							       &surface_overlap)) {
+			spare--;
 			pixman_region32_fini(&es->damage);
 			pixman_region32_init(&es->damage);
 		} else {
@@ -762,6 +1672,70 @@ drm_assign_planes(struct weston_output *output)
 	drm_disable_unused_sprites(output);
 }
 
+static void
+drm_output_cursor_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct drm_output *output =
+		container_of(listener, struct drm_output,
+			     cursor_buffer_destroy_listener);
+
+	output->cursor_buffer = NULL;
+}
+
+static void
+drm_output_set_cursor_buffer(struct drm_output *output,
+			     struct wl_buffer *buffer)
+{
+	if (output->cursor_buffer)
+		wl_list_remove(&output->cursor_buffer_destroy_listener.link);
+
+	output->cursor_buffer = buffer;
+	if (buffer)
+		wl_signal_add(&buffer->resource.destroy_signal,
+			      &output->cursor_buffer_destroy_listener);
+}
+
+/* Copy the sprite image into the spare cursor bo, unless it is the
+ * image already shown.  Returns 1 if the spare bo now holds the image,
+ * 0 if the shown image is unchanged and -1 on failure. */
+static int
+drm_output_update_cursor_image(struct drm_output *output,
+			       struct weston_surface *sprite)
+{
+	size_t size = output->cursor_width * output->cursor_height * 4;
+	int spare = output->current_cursor ^ 1;
+	unsigned char *d, *s, *end;
+	EGLint stride;
+
+	memset(output->cursor_image[spare], 0, size);
+	d = (unsigned char *) output->cursor_image[spare];
+	stride = wl_shm_buffer_get_stride(sprite->buffer);
+	s = wl_shm_buffer_get_data(sprite->buffer);
+	end = s + stride * sprite->geometry.height;
+	while (s < end) {
+		memcpy(d, s, sprite->geometry.width * 4);
+		s += stride;
+		d += output->cursor_width * 4;
+	}
+
+	drm_output_set_cursor_buffer(output, sprite->buffer);
+	output->cursor_serial = sprite->content_serial;
+
+	if (memcmp(output->cursor_image[spare],
+		   output->cursor_image[output->current_cursor], size) == 0)
+		return 0;
+
+	if (gbm_bo_write(output->cursor_bo[spare],
+			 output->cursor_image[spare], size) < 0) {
+		drm_output_set_cursor_buffer(output, NULL);
+		return -1;
+	}
+
+	output->current_cursor = spare;
+
+	return 1;
+}
+
 static int
 drm_output_set_cursor(struct weston_output *output_base,
 		      struct weston_seat *es)
@@ -769,63 +1743,163 @@ drm_output_set_cursor(struct weston_output *output_base,
 	struct drm_output *output = (struct drm_output *) output_base;
 	struct drm_compositor *c =
 		(struct drm_compositor *) output->base.compositor;
-	EGLint handle, stride;
-	int ret = -1;
-	struct gbm_bo *bo;
-	uint32_t buf[64 * 64];
-	unsigned char *d, *s, *end;
+	struct weston_surface *sprite;
+	EGLint handle;
+	int32_t x, y;
+	int ret;
 
 	if (es == NULL) {
-		drmModeSetCursor(c->drm.fd, output->crtc_id, 0, 0, 0);
+		if (output->cursor_surface)
+			drmModeSetCursor(c->drm.fd, output->crtc_id, 0, 0, 0);
+		output->cursor_surface = NULL;
 		return 0;
 	}
 
-	if (es->sprite->buffer == NULL ||
-	    !wl_buffer_is_shm(es->sprite->buffer))
-		goto out;
+	sprite = es->sprite;
+	if (output->cursor_bo[0] == NULL || output->cursor_bo[1] == NULL)
+		goto err;
 
-	if (es->sprite->geometry.width > 64 ||
-	    es->sprite->geometry.height > 64)
-		goto out;
+	if (sprite->buffer == NULL || !wl_buffer_is_shm(sprite->buffer))
+		goto err;
 
-	output->current_cursor ^= 1;
-	bo = output->cursor_bo[output->current_cursor];
-	if (bo == NULL)
-		goto out;
+	if (sprite->geometry.width > output->cursor_width ||
+	    sprite->geometry.height > output->cursor_height)
+		goto err;
 
-	memset(buf, 0, sizeof buf);
-	d = (unsigned char *) buf;
-	stride = wl_shm_buffer_get_stride(es->sprite->buffer);
-	s = wl_shm_buffer_get_data(es->sprite->buffer);
-	end = s + stride * es->sprite->geometry.height;
-	while (s < end) {
-		memcpy(d, s, es->sprite->geometry.width * 4);
-		s += stride;
-		d += 64 * 4;
+	/* The sprite is not on the primary plane, so nothing else
+	 * consumes its damage.  Moving it damages it too, so whether
+	 * the image changed is told by the content serial. */
+	pixman_region32_fini(&sprite->damage);
+	pixman_region32_init(&sprite->damage);
+
+	/* The bo is only written when the image changed; a cursor that
+	 * just moved only needs drmModeMoveCursor(). */
+	if (sprite->buffer != output->cursor_buffer ||
+	    sprite->content_serial != output->cursor_serial) {
+		ret = drm_output_update_cursor_image(output, sprite);
+		if (ret < 0)
+			goto err;
+		if (ret > 0)
+			output->cursor_surface = NULL;
+	}
+
+	if (output->cursor_surface != sprite) {
+		handle = gbm_bo_get_handle(
+			output->cursor_bo[output->current_cursor]).s32;
+		ret = drmModeSetCursor(c->drm.fd, output->crtc_id, handle,
+				       output->cursor_width,
+				       output->cursor_height);
+		if (ret) {
+			weston_log("failed to set cursor: %s\n",
+				   strerror(-ret));
+			goto err;
+		}
+		output->cursor_surface = sprite;
+		output->cursor_x = INT32_MIN;
 	}
 
-	if (gbm_bo_write(bo, buf, sizeof buf) < 0)
-		goto out;
-
-	handle = gbm_bo_get_handle(bo).s32;
-	ret = drmModeSetCursor(c->drm.fd, output->crtc_id, handle, 64, 64);
-	if (ret) {
-		weston_log("failed to set cursor: %s\n", strerror(-ret));
-		goto out;
+	x = sprite->geometry.x - output->base.x;
+	y = sprite->geometry.y - output->base.y;
+	if (x != output->cursor_x || y != output->cursor_y) {
+		ret = drmModeMoveCursor(c->drm.fd, output->crtc_id, x, y);
+		if (ret) {
+			weston_log("failed to move cursor: %s\n",
+				   strerror(-ret));
+			goto err;
+		}
+		output->cursor_x = x;
+		output->cursor_y = y;
 	}
 
-	ret = drmModeMoveCursor(c->drm.fd, output->crtc_id,
-				es->sprite->geometry.x - output->base.x,
-				es->sprite->geometry.y - output->base.y);
+	return 0;
+
+err:
+	drmModeSetCursor(c->drm.fd, output->crtc_id, 0, 0, 0);
+	output->cursor_surface = NULL;
+	return -1;
+}
+
+static int
+drm_output_move_cursor(struct weston_output *output_base,
+		       struct weston_surface *sprite)
+{
+	struct drm_output *output = (struct drm_output *) output_base;
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	int32_t x, y;
+	int ret;
+
+	/* Only a cursor this output already shows can be moved without
+	 * going through drm_assign_planes(). */
+	if (output->cursor_surface != sprite || output->base.zoom.active)
+		return -1;
+
+	x = sprite->geometry.x - output->base.x;
+	y = sprite->geometry.y - output->base.y;
+	ret = drmModeMoveCursor(c->drm.fd, output->crtc_id, x, y);
 	if (ret) {
 		weston_log("failed to move cursor: %s\n", strerror(-ret));
-		goto out;
+		return -1;
 	}
 
-out:
-	if (ret)
-		drmModeSetCursor(c->drm.fd, output->crtc_id, 0, 0, 0);
-	return ret;
+	output->cursor_x = x;
+	output->cursor_y = y;
+
+	return 0;
+}
+
+static void
+drm_output_fini_cursor(struct drm_output *output)
+{
+	int i;
+
+	drm_output_set_cursor_buffer(output, NULL);
+
+	for (i = 0; i < 2; i++) {
+		if (output->cursor_bo[i])
+			gbm_bo_destroy(output->cursor_bo[i]);
+		free(output->cursor_image[i]);
+		output->cursor_bo[i] = NULL;
+		output->cursor_image[i] = NULL;
+	}
+}
+
+/* Without cursor bos the hardware cursor is simply never used. */
+static int
+drm_output_init_cursor(struct drm_compositor *c, struct drm_output *output,
+		       int32_t width, int32_t height)
+{
+	size_t size = width * height * 4;
+	int i;
+
+	output->cursor_width = width;
+	output->cursor_height = height;
+	output->cursor_buffer_destroy_listener.notify =
+		drm_output_cursor_buffer_destroy;
+
+	for (i = 0; i < 2; i++) {
+		output->cursor_bo[i] =
+			gbm_bo_create(c->gbm, width, height,
+				      GBM_FORMAT_ARGB8888,
+				      GBM_BO_USE_CURSOR_64X64 |
+				      GBM_BO_USE_WRITE);
+		output->cursor_image[i] = calloc(1, size);
+		if (output->cursor_bo[i] == NULL ||
+		    output->cursor_image[i] == NULL)
+			goto err;
+
+		/* Start from a known image, see
+		 * drm_output_update_cursor_image(). */
+		if (gbm_bo_write(output->cursor_bo[i],
+				 output->cursor_image[i], size) < 0)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	drm_output_fini_cursor(output);
+	return -1;
 }
 
 static void
@@ -839,6 +1913,12 @@ drm_output_destroy(struct weston_output *output_base)
 	if (output->backlight)
 		backlight_destroy(output->backlight);
 
+	if (output->frame_finished)
+		wl_list_remove(&output->finished_link);
+
+	weston_log("kms crtc %d: %u frames, %u missed vblanks\n",
+		   output->crtc_id, output->frames, output->missed_vblanks);
+
 	/* Turn off hardware cursor */
 	drm_output_set_cursor(&output->base, NULL);
 
@@ -851,8 +1931,14 @@ drm_output_destroy(struct weston_output *output_base)
 	c->crtc_allocator &= ~(1 << output->crtc_id);
 	c->connector_allocator &= ~(1 << output->connector_id);
 
-	eglDestroySurface(c->base.egl_display, output->egl_surface);
-	gbm_surface_destroy(output->surface);
+	if (option_dumb_buffers) {
+		drm_dumb_target_fini(&output->dumb);
+	} else {
+		eglDestroySurface(c->base.egl_display, output->egl_surface);
+		gbm_surface_destroy(output->surface);
+	}
+
+	drm_output_fini_cursor(output);
 
 	weston_output_destroy(&output->base);
 	wl_list_remove(&output->base.link);
@@ -885,6 +1971,45 @@ choose_mode (struct drm_output *output, struct weston_mode *target_mode)
 	return tmp_mode;
 }
 
+static int
+drm_output_switch_mode_dumb(struct drm_output *output,
+			    struct drm_mode *drm_mode)
+{
+	struct drm_compositor *ec =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_dumb_target dumb;
+	int ret;
+
+	if (drm_dumb_target_init(ec, &dumb, drm_mode->base.width,
+				 drm_mode->base.height) < 0)
+		return -1;
+
+	ret = drmModeSetCrtc(ec->drm.fd, output->crtc_id,
+			     dumb.fb[0]->fb_id, 0, 0,
+			     &output->connector_id, 1, &drm_mode->mode_info);
+	if (ret) {
+		weston_log("failed to set mode\n");
+		drm_dumb_target_fini(&dumb);
+		return -1;
+	}
+
+	if (output->current)
+		drm_output_release_fb(output, output->current);
+	if (output->next)
+		drm_output_release_fb(output, output->next);
+	output->next = NULL;
+
+	drm_dumb_target_fini(&output->dumb);
+	output->dumb = dumb;
+	output->current = dumb.fb[0];
+	output->dumb.back = 1;
+
+	output->base.current = &drm_mode->base;
+	output->base.dirty = 1;
+	weston_output_move(&output->base, output->base.x, output->base.y);
+	return 0;
+}
+
 static int
 drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mode)
 {
@@ -942,6 +2067,9 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 	drm_mode->base.flags =
 		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
 
+	if (option_dumb_buffers)
+		return drm_output_switch_mode_dumb(output, drm_mode);
+
 	surface = gbm_surface_create(ec->gbm,
 			         drm_mode->base.width,
 			         drm_mode->base.height,
@@ -973,22 +2101,12 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 	}
 
 	/* reset rendering stuff. */
-	if (output->current) {
-		if (output->current->is_client_buffer)
-			gbm_bo_destroy(output->current->bo);
-		else
-			gbm_surface_release_buffer(output->surface,
-						   output->current->bo);
-	}
+	if (output->current)
+		drm_output_release_fb(output, output->current);
 	output->current = NULL;
 
-	if (output->next) {
-		if (output->next->is_client_buffer)
-			gbm_bo_destroy(output->next->bo);
-		else
-			gbm_surface_release_buffer(output->surface,
-						   output->next->bo);
-	}
+	if (output->next)
+		drm_output_release_fb(output, output->next);
 	output->next = NULL;
 
 	eglDestroySurface(ec->base.egl_display, output->egl_surface);
@@ -1011,6 +2129,7 @@ err:
 static int
 on_drm_input(int fd, uint32_t mask, void *data)
 {
+	struct drm_compositor *ec = data;
 	drmEventContext evctx;
 
 	memset(&evctx, 0, sizeof evctx);
@@ -1019,6 +2138,8 @@ on_drm_input(int fd, uint32_t mask, void *data)
 	evctx.vblank_handler = vblank_handler;
 	drmHandleEvent(fd, &evctx);
 
+	drm_compositor_finish_frames(ec);
+
 	return 1;
 }
 
@@ -1027,6 +2148,7 @@ init_egl(struct drm_compositor *ec, struct udev_device *device)
 {
 	EGLint major, minor, n;
 	const char *filename, *sysnum;
+	uint64_t cap;
 	int fd;
 	static const EGLint context_attribs[] = {
 		EGL_CONTEXT_CLIENT_VERSION, 2,
@@ -1063,6 +2185,19 @@ init_egl(struct drm_compositor *ec, struct udev_device *device)
 	weston_log("using %s\n", filename);
 
 	ec->drm.fd = fd;
+
+	ec->cursor_width = 64;
+	ec->cursor_height = 64;
+	if (drmGetCap(fd, DRM_CAP_CURSOR_WIDTH, &cap) == 0 && cap > 0)
+		ec->cursor_width = cap;
+	if (drmGetCap(fd, DRM_CAP_CURSOR_HEIGHT, &cap) == 0 && cap > 0)
+		ec->cursor_height = cap;
+
+	if (drmGetCap(fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap) == 0 && cap)
+		ec->clock = CLOCK_MONOTONIC;
+	else
+		ec->clock = CLOCK_REALTIME;
+
 	ec->gbm = gbm_create_device(ec->drm.fd);
 	ec->base.egl_display = eglGetDisplay(ec->gbm);
 	if (ec->base.egl_display == NULL) {
@@ -1183,11 +2318,9 @@ sprite_handle_buffer_destroy(struct wl_listener *listener, void *data)
 	struct drm_sprite *sprite =
 		container_of(listener, struct drm_sprite,
 			     destroy_listener);
-	struct drm_compositor *compositor = sprite->compositor;
 
+	/* The framebuffer stays on the plane until it is replaced. */
 	sprite->surface = NULL;
-	drmModeRmFB(compositor->drm.fd, sprite->fb_id);
-	sprite->fb_id = 0;
 }
 
 static void
@@ -1196,11 +2329,8 @@ sprite_handle_pending_buffer_destroy(struct wl_listener *listener, void *data)
 	struct drm_sprite *sprite =
 		container_of(listener, struct drm_sprite,
 			     pending_destroy_listener);
-	struct drm_compositor *compositor = sprite->compositor;
 
 	sprite->pending_surface = NULL;
-	drmModeRmFB(compositor->drm.fd, sprite->pending_fb_id);
-	sprite->pending_fb_id = 0;
 }
 
 /* returns a value between 0-255 range, where higher is brighter */
@@ -1384,33 +2514,47 @@ create_output_for_connector(struct drm_compositor *ec,
 		preferred->flags |= WL_OUTPUT_MODE_CURRENT;
 	}
 
-	output->surface = gbm_surface_create(ec->gbm,
-					     output->base.current->width,
-					     output->base.current->height,
-					     GBM_FORMAT_XRGB8888,
-					     GBM_BO_USE_SCANOUT |
-					     GBM_BO_USE_RENDERING);
-	if (!output->surface) {
-		weston_log("failed to create gbm surface\n");
-		goto err_free;
-	}
+	if (option_dumb_buffers) {
+		if (drm_dumb_target_init(ec, &output->dumb,
+					 output->base.current->width,
+					 output->base.current->height) < 0)
+			goto err_free;
+	} else {
+		output->surface =
+			gbm_surface_create(ec->gbm,
+					   output->base.current->width,
+					   output->base.current->height,
+					   GBM_FORMAT_XRGB8888,
+					   GBM_BO_USE_SCANOUT |
+					   GBM_BO_USE_RENDERING);
+		if (!output->surface) {
+			weston_log("failed to create gbm surface\n");
+			goto err_free;
+		}
 
-	output->egl_surface =
-		eglCreateWindowSurface(ec->base.egl_display,
-				       ec->base.egl_config,
-				       output->surface,
-				       NULL);
-	if (output->egl_surface == EGL_NO_SURFACE) {
-		weston_log("failed to create egl surface\n");
-		goto err_surface;
+		output->egl_surface =
+			eglCreateWindowSurface(ec->base.egl_display,
+					       ec->base.egl_config,
+					       output->surface,
+					       NULL);
+		if (output->egl_surface == EGL_NO_SURFACE) {
+			weston_log("failed to create egl surface\n");
+			goto err_surface;
+		}
 	}
 
-	output->cursor_bo[0] =
-		gbm_bo_create(ec->gbm, 64, 64, GBM_FORMAT_ARGB8888,
-			      GBM_BO_USE_CURSOR_64X64 | GBM_BO_USE_WRITE);
-	output->cursor_bo[1] =
-		gbm_bo_create(ec->gbm, 64, 64, GBM_FORMAT_ARGB8888,
-			      GBM_BO_USE_CURSOR_64X64 | GBM_BO_USE_WRITE);
+	if (drm_output_init_cursor(ec, output, ec->cursor_width,
+				   ec->cursor_height) < 0 &&
+	    (ec->cursor_width != 64 || ec->cursor_height != 64))
+		drm_output_init_cursor(ec, output, 64, 64);
+
+#ifdef HAVE_DRM_ATOMIC
+	if (ec->atomic_modeset && drm_output_init_atomic(ec, output) < 0) {
+		weston_log("missing atomic modesetting properties, "
+			   "using legacy modesetting\n");
+		ec->atomic_modeset = 0;
+	}
+#endif
 
 	output->backlight = backlight_init(drm_device,
 					   connector->connector_type);
@@ -1431,6 +2575,7 @@ create_output_for_connector(struct drm_compositor *ec,
 	output->base.assign_planes = drm_assign_planes;
 	output->base.set_dpms = drm_set_dpms;
 	output->base.switch_mode = drm_output_switch_mode;
+	output->base.move_cursor = drm_output_move_cursor;
 
 	weston_log("kms connector %d, crtc %d\n",
 		   output->connector_id, output->crtc_id);
@@ -1469,6 +2614,9 @@ create_sprites(struct drm_compositor *ec)
 	struct drm_sprite *sprite;
 	drmModePlaneRes *plane_res;
 	drmModePlane *plane;
+#ifdef HAVE_DRM_ATOMIC
+	uint64_t type;
+#endif
 	uint32_t i;
 
 	plane_res = drmModeGetPlaneResources(ec->drm.fd);
@@ -1483,6 +2631,19 @@ create_sprites(struct drm_compositor *ec)
 		if (!plane)
 			continue;
 
+#ifdef HAVE_DRM_ATOMIC
+		/* With atomic modesetting the kernel also lists the
+		 * primary and cursor planes. */
+		if (ec->atomic_modeset &&
+		    (drm_property_get(ec->drm.fd, plane->plane_id,
+				      DRM_MODE_OBJECT_PLANE, "type",
+				      NULL, &type) < 0 ||
+		     type != DRM_PLANE_TYPE_OVERLAY)) {
+			drmModeFreePlane(plane);
+			continue;
+		}
+#endif
+
 		sprite = malloc(sizeof(*sprite) + ((sizeof(uint32_t)) *
 						   plane->count_formats));
 		if (!sprite) {
@@ -1498,8 +2659,8 @@ create_sprites(struct drm_compositor *ec)
 		sprite->plane_id = plane->plane_id;
 		sprite->surface = NULL;
 		sprite->pending_surface = NULL;
-		sprite->fb_id = 0;
-		sprite->pending_fb_id = 0;
+		sprite->fb = NULL;
+		sprite->pending_fb = NULL;
 		sprite->destroy_listener.notify = sprite_handle_buffer_destroy;
 		sprite->pending_destroy_listener.notify =
 			sprite_handle_pending_buffer_destroy;
@@ -1509,6 +2670,15 @@ create_sprites(struct drm_compositor *ec)
 		       plane->count_formats * sizeof(plane->formats[0]));
 		drmModeFreePlane(plane);
 
+#ifdef HAVE_DRM_ATOMIC
+		if (ec->atomic_modeset &&
+		    drm_plane_get_props(ec->drm.fd, sprite->plane_id,
+					sprite->props) < 0) {
+			free(sprite);
+			continue;
+		}
+#endif
+
 		wl_list_insert(&ec->sprite_list, &sprite->link);
 	}
 
@@ -1530,7 +2700,14 @@ destroy_sprites(struct drm_compositor *compositor)
 				sprite->plane_id,
 				output->crtc_id, 0, 0,
 				0, 0, 0, 0, 0, 0, 0, 0);
-		drmModeRmFB(compositor->drm.fd, sprite->fb_id);
+		if (sprite->surface)
+			wl_list_remove(&sprite->destroy_listener.link);
+		if (sprite->pending_surface)
+			wl_list_remove(&sprite->pending_destroy_listener.link);
+		if (sprite->fb)
+			drm_fb_unref(sprite->fb);
+		if (sprite->pending_fb)
+			drm_fb_unref(sprite->pending_fb);
 		free(sprite);
 	}
 }
@@ -1913,7 +3090,16 @@ drm_compositor_create(struct wl_display *display,
 						  MODIFIER_CTRL | MODIFIER_ALT,
 						  switch_vt_binding, ec);
 
+#ifdef HAVE_DRM_ATOMIC
+	if (getenv("WESTON_DISABLE_ATOMIC") == NULL &&
+	    drmSetClientCap(ec->drm.fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0)
+		ec->atomic_modeset = 1;
+#endif
+	weston_log("using %s modesetting\n",
+		   ec->atomic_modeset ? "atomic" : "legacy");
+
 	wl_list_init(&ec->sprite_list);
+	wl_list_init(&ec->finished_list);
 	create_sprites(ec);
 
 	if (create_outputs(ec, connector, drm_device) < 0) {
@@ -1924,6 +3110,11 @@ drm_compositor_create(struct wl_display *display,
 	path = NULL;
 
 	evdev_input_create(&ec->base, ec->udev, seat);
+	if (ec->base.seat && option_record_input)
+		evdev_input_record(ec->base.seat, option_record_input);
+	if (ec->base.seat && option_replay_input)
+		evdev_input_replay(ec->base.seat, option_replay_input,
+				   option_replay_speed);
 
 	loop = wl_display_get_event_loop(ec->base.wl_display);
 	ec->drm_source =
@@ -1994,6 +3185,10 @@ WL_EXPORT struct weston_compositor *
 		{ WESTON_OPTION_STRING, "seat", 0, &seat },
 		{ WESTON_OPTION_INTEGER, "tty", 0, &tty },
 		{ WESTON_OPTION_BOOLEAN, "current-mode", 0, &option_current_mode },
+		{ WESTON_OPTION_BOOLEAN, "use-dumb-buffers", 0, &option_dumb_buffers },
+		{ WESTON_OPTION_STRING, "record-input", 0, &option_record_input },
+		{ WESTON_OPTION_STRING, "replay-input", 0, &option_replay_input },
+		{ WESTON_OPTION_INTEGER, "replay-speed", 0, &option_replay_speed },
 	};
 
 	*argc = parse_options(drm_options, ARRAY_LENGTH(drm_options),
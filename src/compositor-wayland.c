@@ -42,6 +42,7 @@
 #include <EGL/eglext.h>
 
 #include "compositor.h"
+#include "../shared/os-compatibility.h"
 #include "log.h"
 
 struct wayland_compositor {
@@ -55,6 +56,7 @@ struct wayland_compositor {
 		struct wl_compositor *compositor;
 		struct wl_shell *shell;
 		struct wl_output *output;
+		struct wl_shm *shm;
 
 		struct {
 			int32_t x, y, width, height;
@@ -71,6 +73,15 @@ struct wayland_compositor {
 	} border;
 
 	struct wl_list input_list;
+	int use_shm;
+};
+
+struct wayland_shm_buffer {
+	struct wayland_output	*output;
+	struct wl_buffer	*buffer;
+	uint8_t			*data;
+	int			 busy;		/* attached, not yet released */
+	pixman_region32_t	 damage;	/* window area to copy in */
 };
 
 struct wayland_output {
@@ -83,6 +94,31 @@ struct wayland_output {
 	} parent;
 	EGLSurface egl_surface;
 	struct weston_mode	mode;
+
+	/* A frame with no damage isn't swapped, and the next one has
+	 * to redraw what the one before the skip did. */
+	int			skipped;
+	pixman_region32_t	previous_damage;
+
+	/* With --use-shm the window, border included, is drawn into a
+	 * texture and only the damaged rectangles are copied into one
+	 * of two shm buffers, which is attached to the parent surface
+	 * with just that damage. */
+	struct wayland_shm_buffer shm[2];
+	int			shm_back;
+	pixman_region32_t	parent_damage;	/* not yet sent */
+	void			*shm_data;
+	size_t			shm_size;
+	struct weston_texture_target target;
+	int			border_drawn;
+	int			passthrough;
+
+	/* Frames that aren't sent to the parent are finished from a
+	 * timer, on the parent's clock: the time of the last parent
+	 * frame callback plus the local time elapsed since it came. */
+	struct wl_event_source	*finish_timer;
+	uint32_t		frame_time;
+	uint32_t		frame_local_time;
 };
 
 struct wayland_input {
@@ -265,8 +301,22 @@ wayland_compositor_init_egl(struct wayland_compositor *c)
 		EGL_CONTEXT_CLIENT_VERSION, 2,
 		EGL_NONE
 	};
+	static const EGLint pbuffer_attribs[] = {
+		EGL_WIDTH, 10,
+		EGL_HEIGHT, 10,
+		EGL_NONE
+	};
 
-	c->base.egl_display = eglGetDisplay(c->parent.wl_display);
+	/* With --use-shm nothing GL is ever handed to the parent, so the
+	 * context doesn't come from the parent connection and the parent
+	 * doesn't need to support EGL.  The output is rendered into a
+	 * texture and the context is kept current on a pbuffer. */
+	if (c->use_shm) {
+		config_attribs[1] = EGL_PBUFFER_BIT;
+		c->base.egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	} else {
+		c->base.egl_display = eglGetDisplay(c->parent.wl_display);
+	}
 	if (c->base.egl_display == NULL) {
 		weston_log("failed to create display\n");
 		return -1;
@@ -295,15 +345,23 @@ wayland_compositor_init_egl(struct wayland_compositor *c)
 		return -1;
 	}
 
-	c->dummy_pixmap = wl_egl_pixmap_create(10, 10, 0);
-	if (!c->dummy_pixmap) {
-		weston_log("failure to create dummy_pixmap\n");
-		return -1;
-	}
+	if (c->use_shm) {
+		c->dummy_egl_surface =
+			eglCreatePbufferSurface(c->base.egl_display,
+						c->base.egl_config,
+						pbuffer_attribs);
+	} else {
+		c->dummy_pixmap = wl_egl_pixmap_create(10, 10, 0);
+		if (!c->dummy_pixmap) {
+			weston_log("failure to create dummy_pixmap\n");
+			return -1;
+		}
 
-	c->dummy_egl_surface =
-		eglCreatePixmapSurface(c->base.egl_display, c->base.egl_config,
-				       c->dummy_pixmap, NULL);
+		c->dummy_egl_surface =
+			eglCreatePixmapSurface(c->base.egl_display,
+					       c->base.egl_config,
+					       c->dummy_pixmap, NULL);
+	}
 	if (!eglMakeCurrent(c->base.egl_display, c->dummy_egl_surface,
 			    c->dummy_egl_surface, c->base.egl_context)) {
 		weston_log("failed to make context current\n");
@@ -316,16 +374,461 @@ wayland_compositor_init_egl(struct wayland_compositor *c)
 static void
 frame_done(void *data, struct wl_callback *callback, uint32_t time)
 {
-	struct weston_output *output = data;
+	struct wayland_output *output = data;
 
 	wl_callback_destroy(callback);
-	weston_output_finish_frame(output, time);
+	output->frame_time = time;
+	output->frame_local_time = weston_compositor_get_time();
+	weston_output_finish_frame(&output->base, time);
 }
 
 static const struct wl_callback_listener frame_listener = {
 	frame_done
 };
 
+static int
+finish_frame_handler(void *data)
+{
+	struct wayland_output *output = data;
+	uint32_t elapsed;
+
+	/* The timer was set a refresh after the repaint, so at least
+	 * that much has passed since the last parent frame. */
+	elapsed = weston_compositor_get_time() - output->frame_local_time;
+	if (elapsed < 1000 / output->mode.refresh)
+		elapsed = 1000 / output->mode.refresh;
+
+	weston_output_finish_frame(&output->base,
+				   output->frame_time + elapsed);
+
+	return 1;
+}
+
+/* Nothing is sent to the parent, so no frame callback will come;
+ * finish the frame a refresh from now instead. */
+static void
+wayland_output_skip_frame(struct wayland_output *output)
+{
+	wl_event_source_timer_update(output->finish_timer,
+				     1000 / output->mode.refresh);
+}
+
+static void
+shm_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct wayland_shm_buffer *buffer = data;
+	struct wayland_output *output = buffer->output;
+
+	buffer->busy = 0;
+
+	/* A frame was held back for want of a buffer. */
+	if (pixman_region32_not_empty(&output->parent_damage))
+		weston_output_schedule_repaint(&output->base);
+}
+
+static const struct wl_buffer_listener shm_buffer_listener = {
+	shm_buffer_release
+};
+
+static void
+wayland_output_fini_shm(struct wayland_output *output)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (output->shm[i].buffer)
+			wl_buffer_destroy(output->shm[i].buffer);
+		pixman_region32_fini(&output->shm[i].damage);
+	}
+	pixman_region32_fini(&output->parent_damage);
+
+	if (output->shm_data)
+		munmap(output->shm_data, output->shm_size);
+
+	weston_texture_target_fini(&output->target);
+}
+
+/* The parent only ever sees shm buffers, so it needs no GL; the
+ * window is still composited with a local GL driver, into a
+ * texture. */
+static int
+wayland_output_init_shm(struct wayland_compositor *c,
+			struct wayland_output *output,
+			int width, int height)
+{
+	struct wl_shm_pool *pool;
+	int32_t stride = width * 4;
+	int fd, i;
+
+	for (i = 0; i < 2; i++) {
+		output->shm[i].output = output;
+		pixman_region32_init_rect(&output->shm[i].damage,
+					  0, 0, width, height);
+	}
+	pixman_region32_init(&output->parent_damage);
+
+	if (c->parent.shm == NULL) {
+		weston_log("parent compositor has no wl_shm\n");
+		return -1;
+	}
+
+	output->shm_size = stride * height * 2;
+	fd = os_create_anonymous_file(output->shm_size);
+	if (fd < 0) {
+		weston_log("creating a buffer file for %zu B failed: %m\n",
+			   output->shm_size);
+		return -1;
+	}
+
+	output->shm_data = mmap(NULL, output->shm_size,
+				PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (output->shm_data == MAP_FAILED) {
+		weston_log("mmap failed: %m\n");
+		output->shm_data = NULL;
+		close(fd);
+		return -1;
+	}
+
+	pool = wl_shm_create_pool(c->parent.shm, fd, output->shm_size);
+	for (i = 0; i < 2; i++) {
+		output->shm[i].buffer =
+			wl_shm_pool_create_buffer(pool, i * stride * height,
+						  width, height, stride,
+						  WL_SHM_FORMAT_ARGB8888);
+		wl_buffer_add_listener(output->shm[i].buffer,
+				       &shm_buffer_listener, &output->shm[i]);
+		output->shm[i].data =
+			(uint8_t *) output->shm_data + i * stride * height;
+	}
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	if (!eglMakeCurrent(c->base.egl_display, c->dummy_egl_surface,
+			    c->dummy_egl_surface, c->base.egl_context)) {
+		weston_log("failed to make context current\n");
+		return -1;
+	}
+
+	if (weston_texture_target_init(&output->target, width, height) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int
+wayland_surface_is_sprite(struct weston_compositor *ec,
+			  struct weston_surface *es)
+{
+	struct weston_seat *seat;
+
+	wl_list_for_each(seat, &ec->seat_list, link)
+		if (seat->sprite == es)
+			return 1;
+
+	return 0;
+}
+
+/* Whether a pointer sprite can be blended over a pass-through surface
+ * without GL. */
+static int
+wayland_sprite_is_blendable(struct weston_surface *es)
+{
+	uint32_t format;
+
+	if (es->buffer == NULL || !wl_buffer_is_shm(es->buffer) ||
+	    es->transform.enabled || es->alpha != 1.0 ||
+	    es->buffer->width != es->geometry.width ||
+	    es->buffer->height != es->geometry.height)
+		return 0;
+
+	format = wl_shm_buffer_get_format(es->buffer);
+
+	return format == WL_SHM_FORMAT_ARGB8888 ||
+		format == WL_SHM_FORMAT_XRGB8888;
+}
+
+/* The topmost surface below the pointer sprites, if it is an shm
+ * buffer that covers the output one to one and nothing shows through
+ * it.  Its pixels, with the sprites blended on top, then are the
+ * output, and they can be copied straight into the parent buffer
+ * without compositing. */
+static struct weston_surface *
+wayland_output_passthrough_surface(struct wayland_output *output)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct weston_surface *es;
+	uint32_t format;
+
+	wl_list_for_each(es, &ec->surface_list, link) {
+		if (!wayland_surface_is_sprite(ec, es))
+			break;
+		if (!wayland_sprite_is_blendable(es))
+			return NULL;
+	}
+
+	if (&es->link == &ec->surface_list)
+		return NULL;
+
+	if (es->geometry.x != output->base.x ||
+	    es->geometry.y != output->base.y ||
+	    es->geometry.width != output->mode.width ||
+	    es->geometry.height != output->mode.height ||
+	    es->transform.enabled ||
+	    es->alpha != 1.0 ||
+	    es->buffer == NULL || !wl_buffer_is_shm(es->buffer) ||
+	    es->buffer->width != output->mode.width ||
+	    es->buffer->height != output->mode.height)
+		return NULL;
+
+	format = wl_shm_buffer_get_format(es->buffer);
+	if (format == WL_SHM_FORMAT_XRGB8888)
+		return es;
+
+	/* Buffers are premultiplied, so over black a pixel is just its
+	 * color channels. */
+	if (format == WL_SHM_FORMAT_ARGB8888 &&
+	    (pixman_region32_contains_rectangle(&es->transform.opaque,
+			pixman_region32_extents(&output->base.region)) ==
+	     PIXMAN_REGION_IN || weston_output_black_below(&output->base, es)))
+		return es;
+
+	return NULL;
+}
+
+/* Copy region, in window coordinates, from the pass-through surface.
+ * The parent buffer has alpha, so it is set to opaque on the way. */
+static void
+wayland_output_copy_surface(struct wayland_output *output,
+			    struct wayland_shm_buffer *buffer,
+			    struct weston_surface *es,
+			    pixman_region32_t *region)
+{
+	struct wayland_compositor *c =
+		(struct wayland_compositor *) output->base.compositor;
+	int32_t stride, src_stride, x, y, w, h;
+	pixman_box32_t *rects;
+	uint32_t *src, *dst, *end;
+	uint8_t *data;
+	int i, j, n;
+
+	stride = (output->mode.width + c->border.left + c->border.right) * 4;
+	src_stride = wl_shm_buffer_get_stride(es->buffer);
+	data = wl_shm_buffer_get_data(es->buffer);
+
+	rects = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++) {
+		x = rects[i].x1;
+		y = rects[i].y1;
+		w = rects[i].x2 - rects[i].x1;
+		h = rects[i].y2 - rects[i].y1;
+
+		for (j = 0; j < h; j++) {
+			src = (uint32_t *) (data +
+					    (y + j - c->border.top) *
+					    src_stride +
+					    (x - c->border.left) * 4);
+			dst = (uint32_t *) (buffer->data +
+					    (y + j) * stride + x * 4);
+			for (end = src + w; src < end; src++, dst++)
+				*dst = *src | 0xff000000;
+		}
+	}
+}
+
+/* Blend the pointer sprites above the pass-through surface es over
+ * region, in window coordinates, which has just been copied from es. */
+static void
+wayland_output_blend_sprites(struct wayland_output *output,
+			     struct wayland_shm_buffer *buffer,
+			     struct weston_surface *es,
+			     pixman_region32_t *region)
+{
+	struct wayland_compositor *c =
+		(struct wayland_compositor *) output->base.compositor;
+	struct weston_surface *sprite;
+	pixman_image_t *dst, *src;
+	pixman_format_code_t format;
+	int32_t width, height;
+
+	if (es->link.prev == &c->base.surface_list)
+		return;
+
+	width = output->mode.width + c->border.left + c->border.right;
+	height = output->mode.height + c->border.top + c->border.bottom;
+	dst = pixman_image_create_bits(PIXMAN_a8r8g8b8, width, height,
+				       (uint32_t *) buffer->data, width * 4);
+	pixman_image_set_clip_region32(dst, region);
+
+	/* Bottom up, the topmost sprite last. */
+	for (sprite = container_of(es->link.prev, struct weston_surface, link);
+	     &sprite->link != &c->base.surface_list;
+	     sprite = container_of(sprite->link.prev,
+				   struct weston_surface, link)) {
+		if (wl_shm_buffer_get_format(sprite->buffer) ==
+		    WL_SHM_FORMAT_XRGB8888)
+			format = PIXMAN_x8r8g8b8;
+		else
+			format = PIXMAN_a8r8g8b8;
+
+		src = pixman_image_create_bits(format,
+				sprite->buffer->width, sprite->buffer->height,
+				wl_shm_buffer_get_data(sprite->buffer),
+				wl_shm_buffer_get_stride(sprite->buffer));
+		pixman_image_composite32(PIXMAN_OP_OVER, src, NULL, dst,
+					 0, 0, 0, 0,
+					 sprite->geometry.x - output->base.x +
+					 c->border.left,
+					 sprite->geometry.y - output->base.y +
+					 c->border.top,
+					 sprite->geometry.width,
+					 sprite->geometry.height);
+		pixman_image_unref(src);
+	}
+
+	pixman_image_unref(dst);
+}
+
+static void
+wayland_output_repaint_shm(struct wayland_output *output,
+			   pixman_region32_t *damage)
+{
+	struct wayland_compositor *c =
+		(struct wayland_compositor *) output->base.compositor;
+	struct wayland_shm_buffer *buffer;
+	struct weston_surface *surface, *passthrough = NULL;
+	struct wl_callback *callback;
+	pixman_region32_t window_damage, inner, outer;
+	pixman_box32_t *rects;
+	int32_t width, height;
+	int i, n, first;
+
+	first = !output->border_drawn;
+	if (!first && !pixman_region32_not_empty(damage) &&
+	    !pixman_region32_not_empty(&output->parent_damage)) {
+		wayland_output_skip_frame(output);
+		return;
+	}
+
+	width = output->mode.width + c->border.left + c->border.right;
+	height = output->mode.height + c->border.top + c->border.bottom;
+
+	if (!eglMakeCurrent(c->base.egl_display, c->dummy_egl_surface,
+			    c->dummy_egl_surface, c->base.egl_context)) {
+		weston_log("failed to make current\n");
+		return;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, output->target.fbo);
+
+	if (!first)
+		passthrough = wayland_output_passthrough_surface(output);
+
+	if (passthrough) {
+		/* The texture isn't kept up to date meanwhile. */
+		if (!output->passthrough)
+			weston_log("wayland: passing a fullscreen surface "
+				   "through to the parent\n");
+		output->passthrough = 1;
+	} else {
+		if (output->passthrough) {
+			weston_log("wayland: compositing the output again\n");
+			damage = &output->base.region;
+		}
+		output->passthrough = 0;
+
+		wl_list_for_each_reverse(surface, &c->base.surface_list, link)
+			weston_surface_draw(surface, &output->base, damage);
+
+		/* The texture keeps the border, it only needs drawing
+		 * once. */
+		if (first) {
+			draw_border(output);
+			output->border_drawn = 1;
+		}
+
+		wl_signal_emit(&output->base.frame_signal, output);
+	}
+
+	/* Every buffer collects the damage it missed, so it doesn't
+	 * matter how long ago it was last used. */
+	if (first) {
+		pixman_region32_init_rect(&window_damage,
+					  0, 0, width, height);
+	} else {
+		pixman_region32_init(&window_damage);
+		pixman_region32_copy(&window_damage, damage);
+		pixman_region32_translate(&window_damage,
+					  c->border.left - output->base.x,
+					  c->border.top - output->base.y);
+	}
+	for (i = 0; i < 2; i++)
+		pixman_region32_union(&output->shm[i].damage,
+				      &output->shm[i].damage, &window_damage);
+	pixman_region32_union(&output->parent_damage,
+			      &output->parent_damage, &window_damage);
+	pixman_region32_fini(&window_damage);
+
+	/* Only a buffer the parent has released may be written.  If it
+	 * holds both, the damage waits in the buffers and
+	 * parent_damage, and the frame is sent when one comes back. */
+	buffer = &output->shm[output->shm_back];
+	if (buffer->busy)
+		buffer = &output->shm[output->shm_back ^ 1];
+	if (buffer->busy) {
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		wayland_output_skip_frame(output);
+		return;
+	}
+
+	/* With a pass-through surface only the border comes from the
+	 * texture. */
+	if (passthrough)
+		pixman_region32_init_rect(&inner,
+					  c->border.left, c->border.top,
+					  output->mode.width,
+					  output->mode.height);
+	else
+		pixman_region32_init(&inner);
+	pixman_region32_intersect(&inner, &inner, &buffer->damage);
+	pixman_region32_init(&outer);
+	pixman_region32_subtract(&outer, &buffer->damage, &inner);
+
+	weston_texture_target_read(&c->base, &output->target, &outer,
+				   buffer->data, width * 4);
+	if (passthrough) {
+		wayland_output_copy_surface(output, buffer,
+					    passthrough, &inner);
+		wayland_output_blend_sprites(output, buffer,
+					     passthrough, &inner);
+	}
+
+	pixman_region32_fini(&outer);
+	pixman_region32_fini(&inner);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	pixman_region32_fini(&buffer->damage);
+	pixman_region32_init(&buffer->damage);
+
+	/* Against the buffer attached before, only what was drawn since
+	 * changed. */
+	wl_surface_attach(output->parent.surface, buffer->buffer, 0, 0);
+	rects = pixman_region32_rectangles(&output->parent_damage, &n);
+	for (i = 0; i < n; i++)
+		wl_surface_damage(output->parent.surface,
+				  rects[i].x1, rects[i].y1,
+				  rects[i].x2 - rects[i].x1,
+				  rects[i].y2 - rects[i].y1);
+	pixman_region32_fini(&output->parent_damage);
+	pixman_region32_init(&output->parent_damage);
+
+	buffer->busy = 1;
+	output->shm_back = (buffer - output->shm) ^ 1;
+
+	callback = wl_surface_frame(output->parent.surface);
+	wl_callback_add_listener(callback, &frame_listener, output);
+}
+
 static void
 wayland_output_repaint(struct weston_output *output_base,
 		       pixman_region32_t *damage)
@@ -335,6 +838,18 @@ wayland_output_repaint(struct weston_output *output_base,
 		(struct wayland_compositor *) output->base.compositor;
 	struct wl_callback *callback;
 	struct weston_surface *surface;
+	pixman_region32_t repaint;
+
+	if (compositor->use_shm) {
+		wayland_output_repaint_shm(output, damage);
+		return;
+	}
+
+	if (!pixman_region32_not_empty(damage)) {
+		output->skipped = 1;
+		wayland_output_skip_frame(output);
+		return;
+	}
 
 	if (!eglMakeCurrent(compositor->base.egl_display, output->egl_surface,
 			    output->egl_surface,
@@ -343,8 +858,20 @@ wayland_output_repaint(struct weston_output *output_base,
 		return;
 	}
 
+	/* The damage covers the last two frames, which isn't enough
+	 * for the back buffer if a frame was skipped in between. */
+	pixman_region32_init(&repaint);
+	pixman_region32_copy(&repaint, damage);
+	if (output->skipped)
+		pixman_region32_union(&repaint, &repaint,
+				      &output->previous_damage);
+	pixman_region32_copy(&output->previous_damage, &repaint);
+	output->skipped = 0;
+
 	wl_list_for_each_reverse(surface, &compositor->base.surface_list, link)
-		weston_surface_draw(surface, &output->base, damage);
+		weston_surface_draw(surface, &output->base, &repaint);
+
+	pixman_region32_fini(&repaint);
 
 	draw_border(output);
 
@@ -361,10 +888,18 @@ static void
 wayland_output_destroy(struct weston_output *output_base)
 {
 	struct wayland_output *output = (struct wayland_output *) output_base;
-	struct weston_compositor *ec = output->base.compositor;
+	struct wayland_compositor *c =
+		(struct wayland_compositor *) output->base.compositor;
 
-	eglDestroySurface(ec->egl_display, output->egl_surface);
-	wl_egl_window_destroy(output->parent.egl_window);
+	wl_event_source_remove(output->finish_timer);
+	pixman_region32_fini(&output->previous_damage);
+
+	if (c->use_shm) {
+		wayland_output_fini_shm(output);
+	} else {
+		eglDestroySurface(c->base.egl_display, output->egl_surface);
+		wl_egl_window_destroy(output->parent.egl_window);
+	}
 	free(output);
 
 	return;
@@ -372,11 +907,49 @@ wayland_output_destroy(struct weston_output *output_base)
 
 static const struct wl_shell_surface_listener shell_surface_listener;
 
+static int
+wayland_output_init_egl(struct wayland_compositor *c,
+			struct wayland_output *output, int width, int height)
+{
+	output->parent.egl_window =
+		wl_egl_window_create(output->parent.surface,
+				     width + c->border.left + c->border.right,
+				     height + c->border.top + c->border.bottom);
+	if (!output->parent.egl_window) {
+		weston_log("failure to create wl_egl_window\n");
+		return -1;
+	}
+
+	output->egl_surface =
+		eglCreateWindowSurface(c->base.egl_display, c->base.egl_config,
+				       output->parent.egl_window, NULL);
+	if (!output->egl_surface) {
+		weston_log("failed to create window surface\n");
+		goto cleanup_window;
+	}
+
+	if (!eglMakeCurrent(c->base.egl_display, output->egl_surface,
+			    output->egl_surface, c->base.egl_context)) {
+		weston_log("failed to make surface current\n");
+		goto cleanup_surface;
+	}
+
+	return 0;
+
+cleanup_surface:
+	eglDestroySurface(c->base.egl_display, output->egl_surface);
+cleanup_window:
+	wl_egl_window_destroy(output->parent.egl_window);
+
+	return -1;
+}
+
 static int
 wayland_compositor_create_output(struct wayland_compositor *c,
 				 int width, int height)
 {
 	struct wayland_output *output;
+	struct wl_event_loop *loop;
 
 	output = malloc(sizeof *output);
 	if (output == NULL)
@@ -406,30 +979,27 @@ wayland_compositor_create_output(struct wayland_compositor *c,
 		wl_compositor_create_surface(c->parent.compositor);
 	wl_surface_set_user_data(output->parent.surface, output);
 
-	output->parent.egl_window =
-		wl_egl_window_create(output->parent.surface,
-				     width + c->border.left + c->border.right,
-				     height + c->border.top + c->border.bottom);
-	if (!output->parent.egl_window) {
-		weston_log("failure to create wl_egl_window\n");
+	pixman_region32_init(&output->previous_damage);
+	loop = wl_display_get_event_loop(c->base.wl_display);
+	output->finish_timer =
+		wl_event_loop_add_timer(loop, finish_frame_handler, output);
+	output->frame_local_time = weston_compositor_get_time();
+	output->frame_time = output->frame_local_time;
+
+	if (c->use_shm) {
+		if (wayland_output_init_shm(c, output,
+					    width + c->border.left +
+					    c->border.right,
+					    height + c->border.top +
+					    c->border.bottom) < 0) {
+			weston_log("failed to set up shm output\n");
+			wayland_output_fini_shm(output);
+			goto cleanup_output;
+		}
+	} else if (wayland_output_init_egl(c, output, width, height) < 0) {
 		goto cleanup_output;
 	}
 
-	output->egl_surface =
-		eglCreateWindowSurface(c->base.egl_display, c->base.egl_config,
-				       output->parent.egl_window, NULL);
-	if (!output->egl_surface) {
-		weston_log("failed to create window surface\n");
-		goto cleanup_window;
-	}
-
-	if (!eglMakeCurrent(c->base.egl_display, output->egl_surface,
-			    output->egl_surface, c->base.egl_context)) {
-		weston_log("failed to make surface current\n");
-		goto cleanup_surface;
-		return -1;
-	}
-
 	output->parent.shell_surface =
 		wl_shell_get_shell_surface(c->parent.shell,
 					   output->parent.surface);
@@ -449,12 +1019,10 @@ wayland_compositor_create_output(struct wayland_compositor *c,
 
 	return 0;
 
-cleanup_surface:
-	eglDestroySurface(c->base.egl_display, output->egl_surface);
-cleanup_window:
-	wl_egl_window_destroy(output->parent.egl_window);
 cleanup_output:
 	/* FIXME: cleanup weston_output */
+	wl_event_source_remove(output->finish_timer);
+	pixman_region32_fini(&output->previous_damage);
 	free(output);
 
 	return -1;
@@ -777,6 +1345,9 @@ display_handle_global(struct wl_display *display, uint32_t id,
 			wl_display_bind(display, id, &wl_shell_interface);
 	} else if (strcmp(interface, "wl_seat") == 0) {
 		display_add_seat(c, id);
+	} else if (strcmp(interface, "wl_shm") == 0) {
+		c->parent.shm =
+			wl_display_bind(display, id, &wl_shm_interface);
 	}
 }
 
@@ -833,6 +1404,7 @@ wayland_destroy(struct weston_compositor *ec)
 static struct weston_compositor *
 wayland_compositor_create(struct wl_display *display,
 			  int width, int height, const char *display_name,
+			  int use_shm,
 			  int *argc, char *argv[], const char *config_file)
 {
 	struct wayland_compositor *c;
@@ -844,6 +1416,7 @@ wayland_compositor_create(struct wl_display *display,
 		return NULL;
 
 	memset(c, 0, sizeof *c);
+	c->use_shm = use_shm;
 
 	if (weston_compositor_init(&c->base, display, argc, argv,
 				   config_file) < 0)
@@ -896,16 +1469,18 @@ backend_init(struct wl_display *display, int *argc, char *argv[],
 {
 	int width = 1024, height = 640;
 	char *display_name = NULL;
+	int use_shm = 0;
 
 	const struct weston_option wayland_options[] = {
 		{ WESTON_OPTION_INTEGER, "width", 0, &width },
 		{ WESTON_OPTION_INTEGER, "height", 0, &height },
 		{ WESTON_OPTION_STRING, "display", 0, &display_name },
+		{ WESTON_OPTION_BOOLEAN, "use-shm", 0, &use_shm },
 	};
 
 	*argc = parse_options(wayland_options, ARRAY_LENGTH(wayland_options),
 			      *argc, argv);
 
 	return wayland_compositor_create(display, width, height, display_name,
-					 argc, argv, config_file);
+					 use_shm, argc, argv, config_file);
 }
@@ -31,13 +31,21 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
-#include <sys/time.h>
+#include <time.h>
 #include <linux/input.h>
 
 #include <xcb/xcb.h>
 #ifdef HAVE_XCB_XKB
 #include <xcb/xkb.h>
 #endif
+#ifdef HAVE_XCB_SHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <xcb/shm.h>
+#endif
+#ifdef HAVE_XCB_PRESENT
+#include <xcb/present.h>
+#endif
 
 #include <X11/Xlib.h>
 #include <X11/Xlib-xcb.h>
@@ -45,6 +53,7 @@
 #include <xkbcommon/xkbcommon.h>
 
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
 
 #include "compositor.h"
@@ -65,6 +74,16 @@ struct x11_compositor {
 	struct xkb_keymap	*xkb_keymap;
 	unsigned int		 has_xkb;
 	uint8_t			 xkb_event_base;
+	int			 use_shm;
+	uint8_t			 shm_event_base;
+#ifdef HAVE_XCB_PRESENT
+	/* Present events come in on a connection of their own, so that
+	 * they are handled while the input loop isn't polled. */
+	xcb_connection_t	*present_conn;
+	struct wl_event_source	*present_source;
+	uint8_t			 present_opcode;
+	uint32_t		 present_serial;
+#endif
 	struct {
 		xcb_atom_t		 wm_protocols;
 		xcb_atom_t		 wm_normal_hints;
@@ -82,6 +101,18 @@ struct x11_compositor {
 	} atom;
 };
 
+#ifdef HAVE_XCB_SHM
+struct x11_shm_image {
+	xcb_shm_seg_t		seg;
+	int			shmid;
+	uint8_t			*data;
+	/* The server may still read the image until the ShmCompletion
+	 * for the last put, put_seq, arrives. */
+	int			busy;
+	unsigned int		put_seq;
+};
+#endif
+
 struct x11_output {
 	struct weston_output	base;
 
@@ -89,6 +120,17 @@ struct x11_output {
 	EGLSurface		egl_surface;
 	struct weston_mode	mode;
 	struct wl_event_source *finish_frame_timer;
+	uint64_t		frame_us;	/* CLOCK_MONOTONIC */
+
+#ifdef HAVE_XCB_SHM
+	/* With --use-shm the output is drawn into a texture, and the
+	 * damage is copied to shm[shm_back] and put from there into the
+	 * window. */
+	xcb_gcontext_t		gc;
+	struct x11_shm_image	shm[2];
+	int			shm_back;
+	struct weston_texture_target target;
+#endif
 };
 
 struct x11_input {
@@ -317,6 +359,318 @@ x11_compositor_fini_egl(struct x11_compositor *compositor)
 	eglReleaseThread();
 }
 
+static uint64_t
+x11_get_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Finish the frame just drawn at the next vblank of the host server,
+ * as told by Present, or else at the next multiple of the refresh
+ * period after the previous frame.  Keeping the phase means a slow
+ * repaint drops a frame instead of shifting all frames after it.
+ */
+static void
+x11_output_schedule_finish(struct x11_output *output)
+{
+	struct x11_compositor *c =
+		(struct x11_compositor *) output->base.compositor;
+	uint64_t now, next, refresh_us;
+
+#ifdef HAVE_XCB_PRESENT
+	if (c->present_conn) {
+		xcb_present_notify_msc(c->present_conn, output->window,
+				       c->present_serial++, 0, 1, 0);
+		xcb_flush(c->present_conn);
+		return;
+	}
+#endif
+
+	/* refresh is in mHz */
+	refresh_us = 1000000000ULL / output->mode.refresh;
+	now = x11_get_time_us();
+	next = output->frame_us + refresh_us;
+	if (next <= now)
+		next += ((now - next) / refresh_us + 1) * refresh_us;
+
+	output->frame_us = next;
+	wl_event_source_timer_update(output->finish_frame_timer,
+				     (next - now + 999) / 1000);
+}
+
+#ifdef HAVE_XCB_PRESENT
+static struct x11_output *
+x11_compositor_find_output(struct x11_compositor *c, xcb_window_t window);
+
+static int
+x11_compositor_handle_present_event(int fd, uint32_t mask, void *data)
+{
+	struct x11_compositor *c = data;
+	xcb_generic_event_t *event;
+	xcb_present_generic_event_t *ge;
+	xcb_present_complete_notify_event_t *complete;
+	struct x11_output *output;
+
+	while ((event = xcb_poll_for_event(c->present_conn))) {
+		ge = (xcb_present_generic_event_t *) event;
+		if ((event->response_type & ~0x80) != XCB_GE_GENERIC ||
+		    ge->extension != c->present_opcode ||
+		    ge->evtype != XCB_PRESENT_COMPLETE_NOTIFY) {
+			free(event);
+			continue;
+		}
+
+		complete = (xcb_present_complete_notify_event_t *) event;
+		output = x11_compositor_find_output(c, complete->window);
+		if (output) {
+			output->frame_us = complete->ust;
+			weston_output_finish_frame(&output->base,
+						   complete->ust / 1000);
+		}
+		free(event);
+	}
+
+	return 1;
+}
+
+static void
+x11_compositor_init_present(struct x11_compositor *c)
+{
+	const xcb_query_extension_reply_t *ext;
+	xcb_present_query_version_reply_t *version;
+	struct wl_event_loop *loop;
+
+	c->present_conn = xcb_connect(NULL, NULL);
+	if (xcb_connection_has_error(c->present_conn))
+		goto err;
+
+	ext = xcb_get_extension_data(c->present_conn, &xcb_present_id);
+	if (ext == NULL || !ext->present) {
+		weston_log("Present extension not available on host X11 "
+			   "server\n");
+		goto err;
+	}
+	c->present_opcode = ext->major_opcode;
+
+	version = xcb_present_query_version_reply(c->present_conn,
+		xcb_present_query_version(c->present_conn,
+					  XCB_PRESENT_MAJOR_VERSION,
+					  XCB_PRESENT_MINOR_VERSION), NULL);
+	if (version == NULL)
+		goto err;
+	free(version);
+
+	loop = wl_display_get_event_loop(c->base.wl_display);
+	c->present_source =
+		wl_event_loop_add_fd(loop,
+				     xcb_get_file_descriptor(c->present_conn),
+				     WL_EVENT_READABLE,
+				     x11_compositor_handle_present_event, c);
+	weston_log("using Present for frame timing\n");
+	return;
+
+err:
+	weston_log("failed to set up Present, using timers\n");
+	xcb_disconnect(c->present_conn);
+	c->present_conn = NULL;
+}
+
+static void
+x11_output_init_present(struct x11_compositor *c, struct x11_output *output)
+{
+	/* Make sure the window exists before the other connection
+	 * refers to it. */
+	free(xcb_get_input_focus_reply(c->conn, xcb_get_input_focus(c->conn),
+				       NULL));
+
+	xcb_present_select_input(c->present_conn,
+				 xcb_generate_id(c->present_conn),
+				 output->window,
+				 XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+	xcb_flush(c->present_conn);
+}
+#endif
+
+#ifdef HAVE_XCB_SHM
+static int
+x11_shm_image_init(struct x11_compositor *c, struct x11_shm_image *image,
+		   int width, int height)
+{
+	xcb_generic_error_t *err;
+	xcb_void_cookie_t cookie;
+
+	image->shmid = shmget(IPC_PRIVATE, width * height * 4,
+			      IPC_CREAT | 0600);
+	if (image->shmid == -1) {
+		weston_log("x11 shm: shmget failed: %m\n");
+		return -1;
+	}
+
+	image->data = shmat(image->shmid, NULL, 0);
+	/* Gone as soon as both we and the X server detach */
+	shmctl(image->shmid, IPC_RMID, NULL);
+	if (image->data == (void *) -1) {
+		weston_log("x11 shm: shmat failed: %m\n");
+		image->data = NULL;
+		return -1;
+	}
+
+	image->seg = xcb_generate_id(c->conn);
+	cookie = xcb_shm_attach_checked(c->conn, image->seg, image->shmid, 0);
+	err = xcb_request_check(c->conn, cookie);
+	if (err) {
+		weston_log("x11 shm: xcb_shm_attach failed, error %d\n",
+			   err->error_code);
+		free(err);
+		shmdt(image->data);
+		image->data = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+x11_shm_image_fini(struct x11_compositor *c, struct x11_shm_image *image)
+{
+	if (image->data == NULL)
+		return;
+
+	xcb_shm_detach(c->conn, image->seg);
+	shmdt(image->data);
+	image->data = NULL;
+}
+
+static void
+x11_output_fini_shm(struct x11_output *output)
+{
+	struct x11_compositor *c =
+		(struct x11_compositor *) output->base.compositor;
+
+	x11_shm_image_fini(c, &output->shm[0]);
+	x11_shm_image_fini(c, &output->shm[1]);
+
+	weston_texture_target_fini(&output->target);
+
+	if (output->gc)
+		xcb_free_gc(c->conn, output->gc);
+}
+
+/* The renderer is GL, but it doesn't need the host X server to do GL:
+ * the output is drawn into a texture and only the damaged rectangles
+ * are put into the window, from a pair of shared memory images. */
+static int
+x11_output_init_shm(struct x11_compositor *c, struct x11_output *output,
+		    int width, int height)
+{
+	if (x11_shm_image_init(c, &output->shm[0], width, height) < 0 ||
+	    x11_shm_image_init(c, &output->shm[1], width, height) < 0)
+		return -1;
+
+	output->gc = xcb_generate_id(c->conn);
+	xcb_create_gc(c->conn, output->gc, output->window, 0, NULL);
+
+	if (!eglMakeCurrent(c->base.egl_display, c->dummy_pbuffer,
+			    c->dummy_pbuffer, c->base.egl_context)) {
+		weston_log("failed to make context current\n");
+		return -1;
+	}
+
+	return weston_texture_target_init(&output->target, width, height);
+}
+
+/* Put a rectangle of image, in output coordinates, into the window. */
+static void
+x11_output_put_image(struct x11_output *output, struct x11_shm_image *image,
+		     int x, int y, int width, int height)
+{
+	struct x11_compositor *c =
+		(struct x11_compositor *) output->base.compositor;
+	xcb_void_cookie_t cookie;
+
+	cookie = xcb_shm_put_image(c->conn, output->window, output->gc,
+				   output->mode.width, output->mode.height,
+				   x, y, width, height, x, y,
+				   c->screen->root_depth,
+				   XCB_IMAGE_FORMAT_Z_PIXMAP,
+				   1, image->seg, 0);
+	image->busy = 1;
+	image->put_seq = cookie.sequence;
+}
+
+/* Make sure the server is done reading image before it is written.
+ * Usually its ShmCompletion came in long ago; if not, a round trip
+ * tells us the server has handled every put before it. */
+static void
+x11_output_wait_for_image(struct x11_output *output,
+			  struct x11_shm_image *image)
+{
+	struct x11_compositor *c =
+		(struct x11_compositor *) output->base.compositor;
+
+	if (!image->busy)
+		return;
+
+	free(xcb_get_input_focus_reply(c->conn,
+				       xcb_get_input_focus(c->conn), NULL));
+	image->busy = 0;
+}
+
+static void
+x11_output_repaint_shm(struct x11_output *output, pixman_region32_t *damage)
+{
+	struct x11_compositor *c =
+		(struct x11_compositor *) output->base.compositor;
+	struct x11_shm_image *image = &output->shm[output->shm_back];
+	struct weston_surface *surface;
+	pixman_region32_t region;
+	pixman_box32_t *rects;
+	int i, n;
+
+	if (!eglMakeCurrent(c->base.egl_display, c->dummy_pbuffer,
+			    c->dummy_pbuffer, c->base.egl_context)) {
+		weston_log("failed to make current\n");
+		return;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, output->target.fbo);
+
+	wl_list_for_each_reverse(surface, &c->base.surface_list, link)
+		weston_surface_draw(surface, &output->base, damage);
+
+	wl_signal_emit(&output->base.frame_signal, output);
+
+	x11_output_wait_for_image(output, image);
+
+	/* The image was put two frames ago, and the damage covers both
+	 * frames since. */
+	pixman_region32_init(&region);
+	pixman_region32_copy(&region, damage);
+	pixman_region32_translate(&region,
+				  -output->base.x, -output->base.y);
+
+	weston_texture_target_read(&c->base, &output->target, &region,
+				   image->data, output->mode.width * 4);
+
+	rects = pixman_region32_rectangles(&region, &n);
+	for (i = 0; i < n; i++)
+		x11_output_put_image(output, image, rects[i].x1, rects[i].y1,
+				     rects[i].x2 - rects[i].x1,
+				     rects[i].y2 - rects[i].y1);
+	pixman_region32_fini(&region);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	xcb_flush(c->conn);
+
+	output->shm_back ^= 1;
+}
+#endif
+
 static void
 x11_output_repaint(struct weston_output *output_base,
 		   pixman_region32_t *damage)
@@ -326,6 +680,14 @@ x11_output_repaint(struct weston_output *output_base,
 		(struct x11_compositor *)output->base.compositor;
 	struct weston_surface *surface;
 
+#ifdef HAVE_XCB_SHM
+	if (compositor->use_shm) {
+		x11_output_repaint_shm(output, damage);
+		x11_output_schedule_finish(output);
+		return;
+	}
+#endif
+
 	if (!eglMakeCurrent(compositor->base.egl_display, output->egl_surface,
 			    output->egl_surface,
 			    compositor->base.egl_context)) {
@@ -340,19 +702,15 @@ x11_output_repaint(struct weston_output *output_base,
 
 	eglSwapBuffers(compositor->base.egl_display, output->egl_surface);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 10);
+	x11_output_schedule_finish(output);
 }
 
 static int
 finish_frame_handler(void *data)
 {
 	struct x11_output *output = data;
-	uint32_t msec;
-	struct timeval tv;
-	
-	gettimeofday(&tv, NULL);
-	msec = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-	weston_output_finish_frame(&output->base, msec);
+
+	weston_output_finish_frame(&output->base, output->frame_us / 1000);
 
 	return 1;
 }
@@ -367,7 +725,13 @@ x11_output_destroy(struct weston_output *output_base)
 	wl_list_remove(&output->base.link);
 	wl_event_source_remove(output->finish_frame_timer);
 
-	eglDestroySurface(compositor->base.egl_display, output->egl_surface);
+#ifdef HAVE_XCB_SHM
+	if (compositor->use_shm)
+		x11_output_fini_shm(output);
+	else
+#endif
+		eglDestroySurface(compositor->base.egl_display,
+				  output->egl_surface);
 
 	xcb_destroy_window(compositor->conn, output->window);
 
@@ -566,23 +930,41 @@ x11_compositor_create_output(struct x11_compositor *c, int x, int y,
 		x11_output_change_state(output, 1,
 					c->atom.net_wm_state_fullscreen);
 
-	output->egl_surface = 
-		eglCreateWindowSurface(c->base.egl_display, c->base.egl_config,
-				       output->window, NULL);
-	if (!output->egl_surface) {
-		weston_log("failed to create window surface\n");
-		return -1;
-	}
-	if (!eglMakeCurrent(c->base.egl_display, output->egl_surface,
-			    output->egl_surface, c->base.egl_context)) {
-		weston_log("failed to make surface current\n");
-		return -1;
+#ifdef HAVE_XCB_SHM
+	if (c->use_shm) {
+		if (x11_output_init_shm(c, output, width, height) < 0) {
+			weston_log("failed to set up shm output\n");
+			x11_output_fini_shm(output);
+			return -1;
+		}
+	} else
+#endif
+	{
+		output->egl_surface =
+			eglCreateWindowSurface(c->base.egl_display,
+					       c->base.egl_config,
+					       output->window, NULL);
+		if (!output->egl_surface) {
+			weston_log("failed to create window surface\n");
+			return -1;
+		}
+		if (!eglMakeCurrent(c->base.egl_display, output->egl_surface,
+				    output->egl_surface,
+				    c->base.egl_context)) {
+			weston_log("failed to make surface current\n");
+			return -1;
+		}
 	}
 
 	loop = wl_display_get_event_loop(c->base.wl_display);
 	output->finish_frame_timer =
 		wl_event_loop_add_timer(loop, finish_frame_handler, output);
 
+#ifdef HAVE_XCB_PRESENT
+	if (c->present_conn)
+		x11_output_init_present(c, output);
+#endif
+
 	output->base.origin = output->base.current;
 	output->base.repaint = x11_output_repaint;
 	output->base.destroy = x11_output_destroy;
@@ -612,6 +994,32 @@ x11_compositor_find_output(struct x11_compositor *c, xcb_window_t window)
 	return NULL;
 }
 
+#ifdef HAVE_XCB_SHM
+static void
+x11_compositor_handle_shm_completion(struct x11_compositor *c,
+				     xcb_generic_event_t *event)
+{
+	xcb_shm_completion_event_t *completion =
+		(xcb_shm_completion_event_t *) event;
+	struct x11_output *output;
+	struct x11_shm_image *image;
+	int i;
+
+	output = x11_compositor_find_output(c, completion->drawable);
+	if (output == NULL)
+		return;
+
+	/* Completions of puts older than the last one don't free the
+	 * image. */
+	for (i = 0; i < 2; i++) {
+		image = &output->shm[i];
+		if (image->seg == completion->shmseg &&
+		    (int32_t) (event->full_sequence - image->put_seq) >= 0)
+			image->busy = 0;
+	}
+}
+#endif
+
 static uint32_t
 get_xkb_mod_mask(struct x11_compositor *c, uint32_t in)
 {
@@ -888,6 +1296,20 @@ x11_compositor_handle_event(int fd, uint32_t mask, void *data)
 		case XCB_EXPOSE:
 			expose = (xcb_expose_event_t *) event;
 			output = x11_compositor_find_output(c, expose->window);
+#ifdef HAVE_XCB_SHM
+			/* The last image put holds the whole window, so
+			 * exposed parts can be put again without a
+			 * repaint. */
+			if (c->use_shm) {
+				i = output->shm_back ^ 1;
+				x11_output_put_image(output, &output->shm[i],
+						     expose->x, expose->y,
+						     expose->width,
+						     expose->height);
+				xcb_flush(c->conn);
+				break;
+			}
+#endif
 			weston_output_schedule_repaint(&output->base);
 			break;
 
@@ -942,6 +1364,13 @@ x11_compositor_handle_event(int fd, uint32_t mask, void *data)
 			break;
 		}
 
+#ifdef HAVE_XCB_SHM
+		if (c->use_shm &&
+		    (event->response_type & ~0x80) ==
+		    c->shm_event_base + XCB_SHM_COMPLETION)
+			x11_compositor_handle_shm_completion(c, event);
+#endif
+
 #ifdef HAVE_XCB_XKB
 		if (c->has_xkb &&
 		    (event->response_type & ~0x80) == c->xkb_event_base) {
@@ -1038,16 +1467,47 @@ x11_destroy(struct weston_compositor *ec)
 
 	weston_compositor_shutdown(ec); /* destroys outputs, too */
 
+#ifdef HAVE_XCB_PRESENT
+	if (compositor->present_conn) {
+		wl_event_source_remove(compositor->present_source);
+		xcb_disconnect(compositor->present_conn);
+	}
+#endif
+
 	x11_compositor_fini_egl(compositor);
 
 	XCloseDisplay(compositor->dpy);
 	free(ec);
 }
 
+#ifdef HAVE_XCB_SHM
+static int
+x11_compositor_has_shm(struct x11_compositor *c)
+{
+	const xcb_query_extension_reply_t *ext;
+
+	ext = xcb_get_extension_data(c->conn, &xcb_shm_id);
+	if (ext == NULL || !ext->present) {
+		weston_log("MIT-SHM extension not available on host X11 "
+			   "server\n");
+		return 0;
+	}
+
+	if (c->screen->root_depth != 24) {
+		weston_log("shm output needs a depth 24 root window\n");
+		return 0;
+	}
+
+	c->shm_event_base = ext->first_event;
+
+	return 1;
+}
+#endif
+
 static struct weston_compositor *
 x11_compositor_create(struct wl_display *display,
 		      int width, int height, int count, int fullscreen,
-		      int no_input,
+		      int no_input, int use_shm, int use_present,
 		      int *argc, char *argv[], const char *config_file)
 {
 	struct x11_compositor *c;
@@ -1082,10 +1542,26 @@ x11_compositor_create(struct wl_display *display,
 
 	x11_compositor_get_resources(c);
 
+#ifdef HAVE_XCB_SHM
+	if (use_shm)
+		c->use_shm = x11_compositor_has_shm(c);
+#else
+	if (use_shm)
+		weston_log("XCB-SHM not available during build\n");
+#endif
+
 	c->base.wl_display = display;
 	if (x11_compositor_init_egl(c) < 0)
 		return NULL;
 
+#ifdef HAVE_XCB_PRESENT
+	if (use_present)
+		x11_compositor_init_present(c);
+#else
+	if (use_present)
+		weston_log("XCB-Present not available during build\n");
+#endif
+
 	c->base.destroy = x11_destroy;
 
 	if (weston_compositor_init_gl(&c->base) < 0)
@@ -1116,7 +1592,7 @@ backend_init(struct wl_display *display, int *argc, char *argv[],
 	     const char *config_file)
 {
 	int width = 1024, height = 640, fullscreen = 0, count = 1;
-	int no_input = 0;
+	int no_input = 0, use_shm = 0, use_present = 0;
 
 	const struct weston_option x11_options[] = {
 		{ WESTON_OPTION_INTEGER, "width", 0, &width },
@@ -1124,6 +1600,8 @@ backend_init(struct wl_display *display, int *argc, char *argv[],
 		{ WESTON_OPTION_BOOLEAN, "fullscreen", 0, &fullscreen },
 		{ WESTON_OPTION_INTEGER, "output-count", 0, &count },
 		{ WESTON_OPTION_BOOLEAN, "no-input", 0, &no_input },
+		{ WESTON_OPTION_BOOLEAN, "use-shm", 0, &use_shm },
+		{ WESTON_OPTION_BOOLEAN, "use-present", 0, &use_present },
 	};
 
 	*argc = parse_options(x11_options, ARRAY_LENGTH(x11_options),
@@ -1131,6 +1609,6 @@ backend_init(struct wl_display *display, int *argc, char *argv[],
 
 	return x11_compositor_create(display,
 				     width, height, count, fullscreen,
-				     no_input,
+				     no_input, use_shm, use_present,
 				     argc, argv, config_file);
 }
@@ -54,6 +54,7 @@
 #include "compositor.h"
 #include "../shared/os-compatibility.h"
 #include "log.h"
+#include "pointer-history-server-protocol.h"
 #include "git-version.h"
 
 static struct wl_list child_process_list;
@@ -706,6 +707,8 @@ weston_surface_attach(struct wl_surface *surface, struct wl_buffer *buffer)
 	struct weston_surface *es = (struct weston_surface *) surface;
 	struct weston_compositor *ec = es->compositor;
 
+	es->content_serial++;
+
 	if (es->buffer) {
 		weston_buffer_post_release(es->buffer);
 		wl_list_remove(&es->buffer_destroy_listener.link);
@@ -899,6 +902,233 @@ out:
 	pixman_region32_fini(&repaint);
 }
 
+/* Whether the surface below es is a black surface covering the output,
+ * like the one the shell puts behind fullscreen surfaces. */
+WL_EXPORT int
+weston_output_black_below(struct weston_output *output,
+			  struct weston_surface *es)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_surface *below;
+
+	if (es->link.next == &ec->surface_list)
+		return 0;
+
+	below = container_of(es->link.next, struct weston_surface, link);
+
+	return below->buffer == NULL &&
+		below->color[0] == 0.0 && below->color[1] == 0.0 &&
+		below->color[2] == 0.0 && below->color[3] == 1.0 &&
+		below->alpha == 1.0 &&
+		pixman_region32_contains_rectangle(&below->transform.boundingbox,
+			pixman_region32_extents(&output->region)) ==
+		PIXMAN_REGION_IN;
+}
+
+typedef uint32_t v4u32 __attribute__ ((vector_size (16)));
+
+static void
+copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
+{
+	uint8_t *dst = vdst;
+	uint8_t *src = vsrc;
+	uint8_t *end = dst + (bytes & ~15);
+	uint32_t *d, *s, *tail;
+	v4u32 v, tmp;
+
+	/* Four pixels at a time; memcpy keeps the loads and stores
+	 * legal for unaligned rows and compiles down to plain vector
+	 * moves. */
+	while (dst < end) {
+		memcpy(&v, src, sizeof v);
+		/*                    A R G B */
+		tmp = v & 0xff00ff00;
+		tmp |= (v >> 16) & 0x000000ff;
+		tmp |= (v << 16) & 0x00ff0000;
+		memcpy(dst, &tmp, sizeof tmp);
+		dst += sizeof tmp;
+		src += sizeof tmp;
+	}
+
+	d = (uint32_t *) dst;
+	s = (uint32_t *) src;
+	tail = d + (bytes & 15) / 4;
+	while (d < tail) {
+		uint32_t p = *s++;
+		uint32_t t = p & 0xff00ff00;
+		t |= (p >> 16) & 0x000000ff;
+		t |= (p << 16) & 0x00ff0000;
+		*d++ = t;
+	}
+}
+
+static void
+copy_row(void *dst, void *src, int bytes, int swap_rb)
+{
+	if (swap_rb)
+		copy_row_swap_RB(dst, src, bytes);
+	else
+		memcpy(dst, src, bytes);
+}
+
+/* Copy height rows of bytes each from a bottom-up GL readback
+ * starting at src into the top-down destination. */
+static void
+copy_yflip(uint8_t *dst, int dst_stride, uint8_t *src, int src_stride,
+	   int height, int bytes, int swap_rb)
+{
+	uint8_t *end;
+
+	src += (height - 1) * src_stride;
+	end = dst + height * dst_stride;
+	while (dst < end) {
+		copy_row(dst, src, bytes, swap_rb);
+		dst += dst_stride;
+		src -= src_stride;
+	}
+}
+
+/* Turn a bottom-up readback into top-down order where it landed,
+ * swapping R and B on the way if needed.  tmp must hold one row. */
+static void
+flip_in_place(uint8_t *data, int stride, int height, int bytes,
+	      int swap_rb, uint8_t *tmp)
+{
+	uint8_t *top, *bottom;
+
+	top = data;
+	bottom = data + (height - 1) * stride;
+	while (top < bottom) {
+		memcpy(tmp, top, bytes);
+		copy_row(top, bottom, bytes, swap_rb);
+		copy_row(bottom, tmp, bytes, swap_rb);
+		top += stride;
+		bottom -= stride;
+	}
+
+	if (top == bottom && swap_rb)
+		copy_row_swap_RB(top, top, bytes);
+}
+
+/* Read the width by height rectangle at x, y, in GL coordinates, of
+ * the bound framebuffer into dst as top-down argb8888 rows of stride
+ * bytes.  The pixels are bounced through tmp, which must hold the whole
+ * rectangle.  If tmp is NULL they are read straight into dst instead,
+ * which needs rows exactly stride bytes long. */
+WL_EXPORT int
+weston_compositor_read_pixels(struct weston_compositor *ec,
+			      int32_t x, int32_t y,
+			      int32_t width, int32_t height,
+			      uint8_t *dst, int32_t stride, uint8_t *tmp)
+{
+	int32_t bytes = width * 4;
+	uint8_t *row;
+	int swap_rb;
+
+	/* read_format is either GL_BGRA_EXT, which matches argb8888 in
+	 * memory, or GL_RGBA, which needs R and B swapped. */
+	swap_rb = ec->read_format == GL_RGBA;
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+	/* GLES2 has no GL_PACK_ROW_LENGTH, so we can only read straight
+	 * into the destination when the rows we read are exactly its
+	 * rows. */
+	if (tmp == NULL) {
+		assert(bytes == stride);
+
+		row = malloc(bytes);
+		if (row == NULL)
+			return -1;
+
+		glReadPixels(x, y, width, height, ec->read_format,
+			     GL_UNSIGNED_BYTE, dst);
+		flip_in_place(dst, stride, height, bytes, swap_rb, row);
+		free(row);
+	} else {
+		glReadPixels(x, y, width, height, ec->read_format,
+			     GL_UNSIGNED_BYTE, tmp);
+		copy_yflip(dst, stride, tmp, bytes, height, bytes, swap_rb);
+	}
+
+	return 0;
+}
+
+/* Backends whose output isn't an EGL window surface, because it ends
+ * up in shm or dumb buffers, composite into a texture and copy the
+ * damage out with weston_texture_target_read(). */
+WL_EXPORT int
+weston_texture_target_init(struct weston_texture_target *target,
+			   int32_t width, int32_t height)
+{
+	memset(target, 0, sizeof *target);
+	target->width = width;
+	target->height = height;
+
+	target->pixels = malloc(width * height * 4);
+	if (target->pixels == NULL)
+		return -1;
+
+	glGenTextures(1, &target->texture);
+	glBindTexture(GL_TEXTURE_2D, target->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+		     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	glGenFramebuffers(1, &target->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, target->texture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+	    GL_FRAMEBUFFER_COMPLETE) {
+		weston_log("output framebuffer object incomplete\n");
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return -1;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	return 0;
+}
+
+WL_EXPORT void
+weston_texture_target_fini(struct weston_texture_target *target)
+{
+	if (target->fbo)
+		glDeleteFramebuffers(1, &target->fbo);
+	if (target->texture)
+		glDeleteTextures(1, &target->texture);
+	free(target->pixels);
+	memset(target, 0, sizeof *target);
+}
+
+/* Copy region, in top-down target coordinates, from the target's
+ * texture to the same place in dst, argb8888 rows of stride bytes. */
+WL_EXPORT void
+weston_texture_target_read(struct weston_compositor *ec,
+			   struct weston_texture_target *target,
+			   pixman_region32_t *region,
+			   uint8_t *dst, int32_t stride)
+{
+	pixman_box32_t *rects;
+	int32_t x, y, w, h;
+	int i, n;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+
+	rects = pixman_region32_rectangles(region, &n);
+	for (i = 0; i < n; i++) {
+		x = rects[i].x1;
+		y = rects[i].y1;
+		w = rects[i].x2 - rects[i].x1;
+		h = rects[i].y2 - rects[i].y1;
+
+		weston_compositor_read_pixels(ec, x, target->height - y - h,
+					      w, h, dst + y * stride + x * 4,
+					      stride, target->pixels);
+	}
+}
+
 WL_EXPORT void
 weston_surface_restack(struct weston_surface *surface, struct wl_list *below)
 {
@@ -1042,6 +1272,9 @@ struct weston_frame_callback {
 	struct wl_list link;
 };
 
+static void
+weston_compositor_flush_motion(struct weston_compositor *ec);
+
 static void
 weston_output_repaint(struct weston_output *output, int msecs)
 {
@@ -1054,6 +1287,11 @@ weston_output_repaint(struct weston_output *output, int msecs)
 	pixman_region32_t opaque, new_damage, output_damage;
 	int32_t width, height;
 
+	/* Pick up any input that arrived since the last frame, so that
+	 * this frame reflects it. */
+	wl_event_loop_dispatch(ec->input_loop, 0);
+	weston_compositor_flush_motion(ec);
+
 	weston_compositor_update_drag_surfaces(ec);
 
 	width = output->current->width +
@@ -1086,6 +1324,8 @@ weston_output_repaint(struct weston_output *output, int msecs)
 		 */
 		output->assign_planes(output);
 
+	weston_output_latency_repaint(output);
+
 	pixman_region32_init(&new_damage);
 	pixman_region32_init(&opaque);
 
@@ -1148,6 +1388,7 @@ weston_output_finish_frame(struct weston_output *output, int msecs)
 	int fd;
 
 	output->frame_time = msecs;
+	weston_output_latency_presented(output);
 	if (output->repaint_needed) {
 		weston_output_repaint(output, msecs);
 		return;
@@ -1341,6 +1582,66 @@ surface_attach(struct wl_client *client,
 		es->configure(es, sx, sy);
 }
 
+/* The weight an update msecs ago still has. */
+static double
+weston_surface_update_decay(uint32_t msecs)
+{
+	if ((int32_t) msecs <= 0)
+		return 1.0;
+
+	return exp(-(double) msecs / WESTON_SURFACE_UPDATE_WINDOW);
+}
+
+/* Damage posted within the same millisecond counts as one update. */
+static void
+weston_surface_record_update(struct weston_surface *surface,
+			     int32_t x, int32_t y,
+			     int32_t width, int32_t height)
+{
+	struct weston_surface_update *u = &surface->update;
+	uint32_t now = weston_compositor_get_time();
+	int32_t x2 = x + width, y2 = y + height;
+	double decay;
+
+	if (x < 0)
+		x = 0;
+	if (y < 0)
+		y = 0;
+	if (x2 > surface->geometry.width)
+		x2 = surface->geometry.width;
+	if (y2 > surface->geometry.height)
+		y2 = surface->geometry.height;
+	if (x2 <= x || y2 <= y)
+		return;
+
+	if (u->count == 0.0 || u->msecs != now) {
+		decay = weston_surface_update_decay(now - u->msecs);
+		u->area *= decay;
+		u->count = u->count * decay + 1.0;
+		u->msecs = now;
+	}
+
+	u->area += (x2 - x) * (y2 - y);
+}
+
+/* Returns the damaged pixels per second the surface posted, averaged
+ * over about the last WESTON_SURFACE_UPDATE_WINDOW ms before msecs,
+ * and the number of updates per such window in *updates. */
+WL_EXPORT uint32_t
+weston_surface_update_rate(struct weston_surface *surface, uint32_t msecs,
+			   uint32_t *updates)
+{
+	struct weston_surface_update *u = &surface->update;
+	double decay;
+
+	decay = weston_surface_update_decay(msecs - u->msecs);
+
+	if (updates)
+		*updates = u->count * decay + 0.5;
+
+	return u->area * decay * 1000 / WESTON_SURFACE_UPDATE_WINDOW;
+}
+
 static void
 surface_damage(struct wl_client *client,
 	       struct wl_resource *resource,
@@ -1350,6 +1651,13 @@ surface_damage(struct wl_client *client,
 
 	pixman_region32_union_rect(&es->damage, &es->damage,
 				   x, y, width, height);
+	weston_surface_record_update(es, x, y, width, height);
+	es->content_serial++;
+
+	weston_latency_tag(&es->compositor->client_latency,
+			   &es->input_latency);
+	es->input_latency.tv_sec = 0;
+	es->input_latency.tv_nsec = 0;
 
 	weston_compositor_schedule_repaint(es->compositor);
 }
@@ -1637,25 +1945,110 @@ clip_pointer_motion(struct weston_seat *seat, wl_fixed_t *fx, wl_fixed_t *fy)
 	}
 }
 
-WL_EXPORT void
-notify_motion(struct wl_seat *seat, uint32_t time, wl_fixed_t x, wl_fixed_t y)
+/* Remember that the client of focus has been sent input, so that the
+ * damage it posts in response can be traced back to the input. */
+static void
+weston_seat_tag_focus(struct wl_surface *focus,
+		      const struct timespec *input_time)
+{
+	struct weston_surface *es = (struct weston_surface *) focus;
+
+	if (es)
+		weston_latency_tag(&es->input_latency, input_time);
+}
+
+static void
+weston_seat_send_motion_samples(struct weston_seat *ws)
+{
+	struct wl_pointer *pointer = ws->seat.pointer;
+	struct weston_surface *focus =
+		(struct weston_surface *) pointer->focus;
+	struct weston_motion_sample *sample;
+	struct wl_resource *resource;
+	struct wl_array samples;
+	int i;
+
+	if (!pointer->focus_resource ||
+	    pointer->grab != &pointer->default_grab ||
+	    wl_list_empty(&ws->motion.resource_list))
+		return;
+
+	wl_array_init(&samples);
+	for (i = 0; i < ws->motion.count; i++) {
+		sample = wl_array_add(&samples, sizeof *sample);
+		if (sample == NULL)
+			break;
+		sample->time = ws->motion.samples[i].time;
+		weston_surface_from_global_fixed(focus,
+						 ws->motion.samples[i].x,
+						 ws->motion.samples[i].y,
+						 &sample->x, &sample->y);
+	}
+
+	wl_list_for_each(resource, &ws->motion.resource_list, link)
+		if (resource->client == pointer->focus_resource->client)
+			pointer_samples_send_samples(resource, &samples);
+
+	wl_array_release(&samples);
+}
+
+/* Move a sprite that is on a hardware cursor plane without repainting.
+ * This only works while the sprite stays within the one output that
+ * shows it and nothing else, like a drag icon, moves along with it. */
+static int
+weston_seat_move_cursor(struct weston_seat *ws, int32_t x, int32_t y)
+{
+	struct weston_surface *sprite = ws->sprite;
+	struct weston_output *output, *target = NULL;
+	pixman_box32_t *box;
+
+	if (sprite->plane == WESTON_PLANE_PRIMARY ||
+	    sprite->geometry.dirty || ws->drag_surface)
+		return -1;
+
+	box = pixman_region32_extents(&sprite->transform.boundingbox);
+	wl_list_for_each(output, &ws->compositor->output_list, link)
+		if (pixman_region32_contains_rectangle(&output->region,
+						       box) == PIXMAN_REGION_IN)
+			target = output;
+
+	if (target == NULL || target->move_cursor == NULL)
+		return -1;
+
+	weston_surface_set_position(sprite,
+				    x - ws->hotspot_x, y - ws->hotspot_y);
+	weston_surface_update_transform(sprite);
+
+	box = pixman_region32_extents(&sprite->transform.boundingbox);
+	if (pixman_region32_contains_rectangle(&target->region,
+					       box) != PIXMAN_REGION_IN)
+		return -1;
+
+	return target->move_cursor(target, sprite);
+}
+
+/* Move everything that follows the pointer to its current position and
+ * send the motion to the grab. */
+static void
+weston_seat_flush_motion(struct weston_seat *ws)
 {
 	const struct wl_pointer_grab_interface *interface;
-	struct weston_seat *ws = (struct weston_seat *) seat;
+	struct wl_seat *seat = &ws->seat;
 	struct weston_compositor *ec = ws->compositor;
 	struct weston_output *output;
+	wl_fixed_t x = seat->pointer->x, y = seat->pointer->y;
 	int32_t ix, iy;
 
-	weston_compositor_activity(ec);
+	if (!ws->motion.pending)
+		return;
 
-	clip_pointer_motion(ws, &x, &y);
+	ws->motion.pending = 0;
 
 	weston_seat_update_drag_surface(seat,
-					x - seat->pointer->x,
-					y - seat->pointer->y);
+					x - ws->motion.x, y - ws->motion.y);
 
-	seat->pointer->x = x;
-	seat->pointer->y = y;
+	ws->motion.x = x;
+	ws->motion.y = y;
 
 	ix = wl_fixed_to_int(x);
 	iy = wl_fixed_to_int(y);
@@ -1667,14 +2060,92 @@ notify_motion(struct wl_seat *seat, uint32_t time, wl_fixed_t x, wl_fixed_t y)
 			weston_output_update_zoom(output, ZOOM_FOCUS_POINTER);
 
 	weston_device_repick(seat);
+	weston_seat_send_motion_samples(ws);
+	ws->motion.count = 0;
+
 	interface = seat->pointer->grab->interface;
-	interface->motion(seat->pointer->grab, time,
+	interface->motion(seat->pointer->grab, ws->motion.time,
 			  seat->pointer->grab->x, seat->pointer->grab->y);
+	weston_seat_tag_focus(seat->pointer->focus, &ws->motion.input_time);
+
+	if (ws->sprite == NULL)
+		return;
 
-	if (ws->sprite) {
+	if (weston_seat_move_cursor(ws, ix, iy) == 0) {
+		weston_latency_record(ec, WESTON_LATENCY_CURSOR,
+				      &ws->motion.input_time);
+	} else {
 		weston_surface_set_position(ws->sprite,
 					    ix - ws->hotspot_x,
 					    iy - ws->hotspot_y);
+		weston_latency_tag(&ws->pointer_latency,
+				   &ws->motion.input_time);
+		weston_compositor_schedule_repaint(ec);
+	}
+}
+
+static void
+weston_seat_flush_motion_idle(void *data)
+{
+	struct weston_seat *ws = data;
+
+	ws->motion.idle_source = NULL;
+	weston_seat_flush_motion(ws);
+}
+
+static void
+weston_compositor_flush_motion(struct weston_compositor *ec)
+{
+	struct weston_seat *seat;
+
+	wl_list_for_each(seat, &ec->seat_list, link)
+		weston_seat_flush_motion(seat);
+}
+
+WL_EXPORT void
+notify_motion(struct wl_seat *seat, uint32_t time, wl_fixed_t x, wl_fixed_t y)
+{
+	struct weston_seat *ws = (struct weston_seat *) seat;
+	struct weston_compositor *ec = ws->compositor;
+	struct weston_motion_sample *sample;
+	struct wl_event_loop *loop;
+
+	weston_compositor_activity(ec);
+
+	clip_pointer_motion(ws, &x, &y);
+
+	seat->pointer->x = x;
+	seat->pointer->y = y;
+
+	/* Make room for the new sample when the history is full, so
+	 * that clients following it never miss one. */
+	if (ws->motion.count == WESTON_MOTION_HISTORY_SIZE)
+		weston_seat_flush_motion(ws);
+
+	sample = &ws->motion.samples[ws->motion.count++];
+	sample->time = time;
+	sample->x = x;
+	sample->y = y;
+
+	if (!ws->motion.pending)
+		ws->motion.input_time = ws->input_time;
+	ws->motion.time = time;
+	ws->motion.pending = 1;
+
+	/* When coalescing, the motion is delivered at the start of the
+	 * next repaint, see weston_output_repaint().  A sprite on a
+	 * hardware cursor plane needs no repaint, so there the motion is
+	 * delivered once the current batch of input is processed. */
+	if (!ec->coalesce_motion) {
+		weston_seat_flush_motion(ws);
+	} else if (ws->sprite && ws->sprite->plane != WESTON_PLANE_PRIMARY) {
+		loop = wl_display_get_event_loop(ec->wl_display);
+		if (ws->motion.idle_source == NULL)
+			ws->motion.idle_source =
+				wl_event_loop_add_idle(loop,
+						       weston_seat_flush_motion_idle,
+						       ws);
+	} else {
 		weston_compositor_schedule_repaint(ec);
 	}
 }
@@ -1699,10 +2170,12 @@ notify_button(struct wl_seat *seat, uint32_t time, int32_t button,
 {
 	struct weston_seat *ws = (struct weston_seat *) seat;
 	struct weston_compositor *compositor = ws->compositor;
-	struct weston_surface *focus =
-		(struct weston_surface *) seat->pointer->focus;
+	struct weston_surface *focus;
 	uint32_t serial = wl_display_next_serial(compositor->wl_display);
 
+	weston_seat_flush_motion(ws);
+	focus = (struct weston_surface *) seat->pointer->focus;
+
 	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
 		if (compositor->ping_handler && focus)
 			compositor->ping_handler(focus, serial);
@@ -1724,6 +2197,7 @@ notify_button(struct wl_seat *seat, uint32_t time, int32_t button,
 
 	seat->pointer->grab->interface->button(seat->pointer->grab, time,
 					       button, state);
+	weston_seat_tag_focus(seat->pointer->focus, &ws->input_time);
 
 	if (seat->pointer->button_count == 1)
 		seat->pointer->grab_serial =
@@ -1736,10 +2210,12 @@ notify_axis(struct wl_seat *seat, uint32_t time, uint32_t axis,
 {
 	struct weston_seat *ws = (struct weston_seat *) seat;
 	struct weston_compositor *compositor = ws->compositor;
-	struct weston_surface *focus =
-		(struct weston_surface *) seat->pointer->focus;
+	struct weston_surface *focus;
 	uint32_t serial = wl_display_next_serial(compositor->wl_display);
 
+	weston_seat_flush_motion(ws);
+	focus = (struct weston_surface *) seat->pointer->focus;
+
 	if (compositor->ping_handler && focus)
 		compositor->ping_handler(focus, serial);
 
@@ -1751,9 +2227,11 @@ notify_axis(struct wl_seat *seat, uint32_t time, uint32_t axis,
 	else
 		return;
 
-	if (seat->pointer->focus_resource)
+	if (seat->pointer->focus_resource) {
 		wl_pointer_send_axis(seat->pointer->focus_resource, time, axis,
 				     value);
+		weston_seat_tag_focus(seat->pointer->focus, &ws->input_time);
+	}
 }
 
 WL_EXPORT void
@@ -1889,6 +2367,7 @@ notify_key(struct wl_seat *seat, uint32_t time, uint32_t key,
 	}
 
 	grab->interface->key(grab, time, key, state);
+	weston_seat_tag_focus(seat->keyboard->focus, &ws->input_time);
 
 	if (update_state == STATE_UPDATE_AUTOMATIC) {
 		update_modifier_state(ws,
@@ -1905,6 +2384,8 @@ notify_pointer_focus(struct wl_seat *seat, struct weston_output *output,
 	struct weston_seat *ws = (struct weston_seat *) seat;
 	struct weston_compositor *compositor = ws->compositor;
 
+	weston_seat_flush_motion(ws);
+
 	if (output) {
 		weston_seat_update_drag_surface(seat,
 						x - seat->pointer->x,
@@ -1912,6 +2393,8 @@ notify_pointer_focus(struct wl_seat *seat, struct weston_output *output,
 
 		seat->pointer->x = x;
 		seat->pointer->y = y;
+		ws->motion.x = x;
+		ws->motion.y = y;
 		compositor->focus = 1;
 		weston_compositor_repick(compositor);
 	} else {
@@ -2044,22 +2527,42 @@ touch_set_focus(struct weston_seat *ws, struct wl_surface *surface)
 
 		seat->touch->focus = surface;
 		seat->touch->focus_resource = resource;
+		ws->touch_focus = surface;
+		ws->touch_focus_resource = resource;
 	} else {
-		if (seat->touch->focus)
+		if (ws->touch_focus)
 			wl_list_remove(&ws->touch_focus_listener.link);
-		if (seat->touch->focus_resource)
+		if (ws->touch_focus_resource)
 			wl_list_remove(&ws->touch_focus_resource_listener.link);
 		seat->touch->focus = NULL;
 		seat->touch->focus_resource = NULL;
+		ws->touch_focus = NULL;
+		ws->touch_focus_resource = NULL;
 	}
 }
 
+/* End the current touch frame: the client gets everything sent since
+ * the previous frame as one group.  The focus outlives the last touch
+ * up until here, so that the frame reaches the client the touch points
+ * went to. */
+static void
+touch_send_frame(struct weston_seat *ws)
+{
+	if (ws->touch_frame_pending && ws->touch_focus_resource)
+		wl_touch_send_frame(ws->touch_focus_resource);
+	ws->touch_frame_pending = 0;
+
+	if (ws->num_tp == 0 && ws->touch_focus)
+		touch_set_focus(ws, NULL);
+}
+
 /**
  * notify_touch - emulates button touches and notifies surfaces accordingly.
  *
  * It assumes always the correct cycle sequence until it gets here: touch_down
  * → touch_update → ... → touch_update → touch_end. The driver is responsible
- * for sending along such order.
+ * for sending along such order, and for calling notify_touch_frame() after
+ * the touch points of each hardware frame.
  *
  */
 WL_EXPORT void
@@ -2082,6 +2585,10 @@ notify_touch(struct wl_seat *seat, uint32_t time, int touch_id,
 		 * to that surface for the remainder of the touch session i.e.
 		 * until all touch points are up again. */
 		if (ws->num_tp == 1) {
+			/* A new session started in the frame that ended
+			 * the previous one. */
+			if (ws->touch_focus)
+				touch_send_frame(ws);
 			es = weston_compositor_pick_surface(ec, x, y, &sx, &sy);
 			touch_set_focus(ws, &es->surface);
 		} else if (ws->touch_focus) {
@@ -2089,11 +2596,13 @@ notify_touch(struct wl_seat *seat, uint32_t time, int touch_id,
 			weston_surface_from_global_fixed(es, x, y, &sx, &sy);
 		}
 
-		if (ws->touch_focus_resource && ws->touch_focus)
+		if (ws->touch_focus_resource && ws->touch_focus) {
 			wl_touch_send_down(ws->touch_focus_resource,
 					   serial, time,
 					   &ws->touch_focus->resource,
 					   touch_id, sx, sy);
+			ws->touch_frame_pending = 1;
+		}
 		break;
 	case WL_TOUCH_MOTION:
 		es = (struct weston_surface *) ws->touch_focus;
@@ -2101,21 +2610,31 @@ notify_touch(struct wl_seat *seat, uint32_t time, int touch_id,
 			break;
 
 		weston_surface_from_global_fixed(es, x, y, &sx, &sy);
-		if (ws->touch_focus_resource)
+		if (ws->touch_focus_resource) {
 			wl_touch_send_motion(ws->touch_focus_resource,
 					     time, touch_id, sx, sy);
+			ws->touch_frame_pending = 1;
+		}
 		break;
 	case WL_TOUCH_UP:
 		weston_compositor_idle_release(ec);
 		ws->num_tp--;
 
-		if (ws->touch_focus_resource)
+		if (ws->touch_focus_resource) {
 			wl_touch_send_up(ws->touch_focus_resource,
 					 serial, time, touch_id);
-		if (ws->num_tp == 0)
-			touch_set_focus(ws, NULL);
+			ws->touch_frame_pending = 1;
+		}
 		break;
 	}
+
+	weston_seat_tag_focus(ws->touch_focus, &ws->input_time);
+}
+
+WL_EXPORT void
+notify_touch_frame(struct wl_seat *seat)
+{
+	touch_send_frame((struct weston_seat *) seat);
 }
 
 static void
@@ -2340,6 +2859,49 @@ bind_seat(struct wl_client *client, void *data, uint32_t version, uint32_t id)
 	wl_seat_send_capabilities(resource, caps);
 }
 
+static void
+pointer_samples_destroy(struct wl_client *client,
+			struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct pointer_samples_interface pointer_samples_implementation = {
+	pointer_samples_destroy
+};
+
+static void
+pointer_history_get_pointer_samples(struct wl_client *client,
+				    struct wl_resource *resource,
+				    uint32_t id,
+				    struct wl_resource *pointer_resource)
+{
+	struct weston_seat *seat = pointer_resource->data;
+	struct wl_resource *cr;
+
+	cr = wl_client_add_object(client, &pointer_samples_interface,
+				  &pointer_samples_implementation, id, seat);
+	if (cr == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_list_insert(&seat->motion.resource_list, &cr->link);
+	cr->destroy = unbind_resource;
+}
+
+static const struct pointer_history_interface pointer_history_implementation = {
+	pointer_history_get_pointer_samples
+};
+
+static void
+bind_pointer_history(struct wl_client *client,
+		     void *data, uint32_t version, uint32_t id)
+{
+	wl_client_add_object(client, &pointer_history_interface,
+			     &pointer_history_implementation, id, data);
+}
+
 static void
 device_handle_new_drag_icon(struct wl_listener *listener, void *data)
 {
@@ -2551,6 +3113,14 @@ weston_seat_init(struct weston_seat *seat, struct weston_compositor *ec)
 	seat->hotspot_y = 16;
 	seat->modifier_state = 0;
 	seat->num_tp = 0;
+	seat->touch_frame_pending = 0;
+
+	seat->motion.pending = 0;
+	seat->motion.count = 0;
+	seat->motion.x = 0;
+	seat->motion.y = 0;
+	seat->motion.idle_source = NULL;
+	wl_list_init(&seat->motion.resource_list);
 
 	seat->drag_surface_destroy_listener.notify =
 		handle_drag_surface_destroy;
@@ -2567,9 +3137,17 @@ weston_seat_init(struct weston_seat *seat, struct weston_compositor *ec)
 WL_EXPORT void
 weston_seat_release(struct weston_seat *seat)
 {
+	struct wl_resource *resource, *next;
+
 	wl_list_remove(&seat->link);
+	wl_list_for_each_safe(resource, next,
+			      &seat->motion.resource_list, link)
+		wl_list_init(&resource->link);
 	/* The global object is destroyed at wl_display_destroy() time. */
 
+	if (seat->motion.idle_source)
+		wl_event_source_remove(seat->motion.idle_source);
+
 	if (seat->sprite)
 		pointer_unmap_sprite(seat);
 
@@ -2829,6 +3407,8 @@ weston_output_destroy(struct weston_output *output)
 {
 	struct weston_compositor *c = output->compositor;
 
+	wl_signal_emit(&output->destroy_signal, output);
+
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
 	output->compositor->output_id_pool &= ~(1 << output->id);
@@ -2903,6 +3483,7 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	weston_output_damage(output);
 
 	wl_signal_init(&output->frame_signal);
+	wl_signal_init(&output->destroy_signal);
 	wl_list_init(&output->animation_list);
 	wl_list_init(&output->resource_list);
 
@@ -3005,9 +3586,14 @@ weston_compositor_init(struct weston_compositor *ec,
 		{ "keymap_variant", CONFIG_KEY_STRING, &xkb_names.variant },
 		{ "keymap_options", CONFIG_KEY_STRING, &xkb_names.options },
         };
+	const struct config_key input_config_keys[] = {
+		{ "coalesce-motion", CONFIG_KEY_BOOLEAN, &ec->coalesce_motion },
+	};
 	const struct config_section cs[] = {
                 { "keyboard",
                   keyboard_config_keys, ARRAY_LENGTH(keyboard_config_keys) },
+		{ "input",
+		  input_config_keys, ARRAY_LENGTH(input_config_keys) },
 	};
 
 	memset(&xkb_names, 0, sizeof(xkb_names));
@@ -3028,13 +3614,17 @@ weston_compositor_init(struct weston_compositor *ec,
 				   ec, compositor_bind))
 		return -1;
 
+	if (!wl_display_add_global(display, &pointer_history_interface,
+				   ec, bind_pointer_history))
+		return -1;
+
 	wl_list_init(&ec->surface_list);
 	wl_list_init(&ec->layer_list);
 	wl_list_init(&ec->seat_list);
 	wl_list_init(&ec->output_list);
-	wl_list_init(&ec->key_binding_list);
-	wl_list_init(&ec->button_binding_list);
-	wl_list_init(&ec->axis_binding_list);
+	weston_binding_table_init(&ec->key_bindings);
+	weston_binding_table_init(&ec->button_bindings);
+	weston_binding_table_init(&ec->axis_bindings);
 	wl_list_init(&ec->fade.animation.link);
 
 	weston_compositor_xkb_init(ec, &xkb_names);
@@ -3042,6 +3632,7 @@ weston_compositor_init(struct weston_compositor *ec,
 	ec->ping_handler = NULL;
 
 	screenshooter_create(ec);
+	latency_create(ec);
 	text_cursor_position_notifier_create(ec);
 	input_method_create(ec);
 
@@ -3095,6 +3686,17 @@ weston_compositor_init_gl(struct weston_compositor *ec)
 	if (strstr(extensions, "GL_EXT_unpack_subimage"))
 		ec->has_unpack_subimage = 1;
 
+	if (strstr(extensions, "GL_NV_pixel_buffer_object") &&
+	    strstr(extensions, "GL_EXT_map_buffer_range") &&
+	    strstr(extensions, "GL_OES_mapbuffer")) {
+		ec->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRangeEXT");
+		ec->unmap_buffer =
+			(void *) eglGetProcAddress("glUnmapBufferOES");
+		if (ec->map_buffer_range && ec->unmap_buffer)
+			ec->has_pbo = 1;
+	}
+
 	extensions =
 		(const char *) eglQueryString(ec->egl_display, EGL_EXTENSIONS);
 	if (!extensions) {
@@ -3140,9 +3742,9 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	wl_list_for_each_safe(output, next, &ec->output_list, link)
 		output->destroy(output);
 
-	weston_binding_list_destroy_all(&ec->key_binding_list);
-	weston_binding_list_destroy_all(&ec->button_binding_list);
-	weston_binding_list_destroy_all(&ec->axis_binding_list);
+	weston_binding_table_destroy_all(&ec->key_bindings);
+	weston_binding_table_destroy_all(&ec->button_bindings);
+	weston_binding_table_destroy_all(&ec->axis_bindings);
 
 	wl_array_release(&ec->vertices);
 	wl_array_release(&ec->indices);
@@ -24,6 +24,7 @@
 #ifndef _WAYLAND_SYSTEM_COMPOSITOR_H_
 #define _WAYLAND_SYSTEM_COMPOSITOR_H_
 
+#include <time.h>
 #include <pixman.h>
 #include <xkbcommon/xkbcommon.h>
 #include <wayland-server.h>
@@ -145,6 +146,13 @@ enum dpms_enum {
 	WESTON_DPMS_OFF
 };
 
+enum weston_latency_path {
+	WESTON_LATENCY_SPRITE,		/* pointer drawn by the renderer */
+	WESTON_LATENCY_CURSOR,		/* pointer on a hardware plane */
+	WESTON_LATENCY_CLIENT,		/* input, client damage, present */
+	WESTON_LATENCY_PATH_COUNT
+};
+
 struct weston_output {
 	uint32_t id;
 
@@ -164,8 +172,17 @@ struct weston_output {
 	struct weston_output_zoom zoom;
 	int dirty;
 	struct wl_signal frame_signal;
+	struct wl_signal destroy_signal;
 	uint32_t frame_time;
 
+	/* Oldest input shown by the frame in flight, per path. */
+	struct timespec latency[WESTON_LATENCY_PATH_COUNT];
+
+	/* CLOCK_MONOTONIC time the frame in flight reached the screen,
+	 * set by backends that know it before finishing the frame.
+	 * Zero means the frame is taken as presented when finished. */
+	struct timespec presented_time;
+
 	char *make, *model;
 	uint32_t subpixel;
 	
@@ -179,6 +196,12 @@ struct weston_output {
 	void (*assign_planes)(struct weston_output *output);
 	int (*switch_mode)(struct weston_output *output, struct weston_mode *mode);
 
+	/* Move a pointer sprite shown on a hardware cursor plane to its
+	 * new position without a repaint.  Returns 0 on success; on
+	 * failure the compositor repaints instead.  Optional. */
+	int (*move_cursor)(struct weston_output *output,
+			   struct weston_surface *sprite);
+
 	/* backlight values are on 0-255 range, where higher is brighter */
 	uint32_t backlight_current;
 	void (*set_backlight)(struct weston_output *output, uint32_t value);
@@ -203,6 +226,13 @@ struct weston_xkb_info {
 	xkb_led_index_t scroll_led;
 };
 
+#define WESTON_MOTION_HISTORY_SIZE 64
+
+struct weston_motion_sample {
+	uint32_t time;
+	wl_fixed_t x, y;
+};
+
 struct weston_seat {
 	struct wl_seat seat;
 	struct wl_pointer pointer;
@@ -224,6 +254,7 @@ struct weston_seat {
 	struct wl_listener saved_kbd_focus_listener;
 
 	uint32_t num_tp;
+	int touch_frame_pending;
 	struct wl_surface *touch_focus;
 	struct wl_listener touch_focus_listener;
 	struct wl_resource *touch_focus_resource;
@@ -238,6 +269,25 @@ struct weston_seat {
 		struct xkb_state *state;
 		enum weston_led leds;
 	} xkb_state;
+
+	/* CLOCK_MONOTONIC time the kernel stamped the input event being
+	 * notified with, if the backend knows it, and the oldest pointer
+	 * motion not yet repainted.  See latency.c. */
+	struct timespec input_time;
+	struct timespec pointer_latency;
+
+	/* Pointer motion not yet delivered to the grab, and the samples
+	 * that led to it, in global coordinates. */
+	struct {
+		int pending;
+		uint32_t time;
+		struct timespec input_time;
+		wl_fixed_t x, y;	/* last delivered position */
+		struct weston_motion_sample samples[WESTON_MOTION_HISTORY_SIZE];
+		int count;
+		struct wl_list resource_list;
+		struct wl_event_source *idle_source;
+	} motion;
 };
 
 struct weston_shader {
@@ -262,6 +312,15 @@ struct weston_layer {
 	struct wl_list link;
 };
 
+/* Must be a power of two. */
+#define WESTON_BINDING_BUCKETS 64
+
+/* Bindings hashed on their key, button or axis and modifier.  Each
+ * bucket holds its bindings in the order they were added. */
+struct weston_binding_table {
+	struct wl_list buckets[WESTON_BINDING_BUCKETS];
+};
+
 struct weston_compositor {
 	struct wl_shm *shm;
 	struct wl_signal destroy_signal;
@@ -296,9 +355,9 @@ struct weston_compositor {
 	struct wl_list seat_list;
 	struct wl_list layer_list;
 	struct wl_list surface_list;
-	struct wl_list key_binding_list;
-	struct wl_list button_binding_list;
-	struct wl_list axis_binding_list;
+	struct weston_binding_table key_bindings;
+	struct weston_binding_table button_bindings;
+	struct weston_binding_table axis_bindings;
 	struct {
 		struct weston_spring spring;
 		struct weston_animation animation;
@@ -317,6 +376,13 @@ struct weston_compositor {
 
 	uint32_t focus;
 
+	/* Deliver pointer motion once per output frame. */
+	int coalesce_motion;
+
+	/* Oldest input answered by client damage not yet repainted. */
+	struct timespec client_latency;
+	struct latency_tracer *latency;
+
 	PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC
 		image_target_renderbuffer_storage;
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
@@ -326,6 +392,10 @@ struct weston_compositor {
 	int has_unpack_subimage;
 	GLenum read_format;
 
+	int has_pbo;
+	PFNGLMAPBUFFERRANGEEXTPROC map_buffer_range;
+	PFNGLUNMAPBUFFEROESPROC unmap_buffer;
+
 	PFNEGLBINDWAYLANDDISPLAYWL bind_display;
 	PFNEGLUNBINDWAYLANDDISPLAYWL unbind_display;
 	int has_bind_display;
@@ -382,9 +452,22 @@ enum {
 	WESTON_PLANE_PRIMARY
 };
 
+/* Time constant of the averages weston_surface_update_rate() keeps. */
+#define WESTON_SURFACE_UPDATE_WINDOW	1000	/* ms */
+
+/* Sums over all updates, each weighted by exp(-age / window), as of
+ * the last update.  Unlike a ring of recent updates they don't
+ * saturate, however fast the surface updates. */
+struct weston_surface_update {
+	uint32_t msecs;		/* last update */
+	double area;		/* damaged pixels */
+	double count;		/* updates */
+};
+
 struct weston_surface {
 	struct wl_surface surface;
 	struct weston_compositor *compositor;
+	struct timespec input_latency;	/* oldest input sent, unanswered */
 	GLuint texture;
 	pixman_region32_t clip;
 	pixman_region32_t damage;
@@ -446,6 +529,14 @@ struct weston_surface {
 
 	struct wl_list frame_callback_list;
 
+	/* Recent damage from the client.  Backends use it to pick
+	 * surfaces for planes. */
+	struct weston_surface_update update;
+
+	/* Bumped when the client attaches a buffer or posts damage.
+	 * Unlike damage, it doesn't change when the surface moves. */
+	uint32_t content_serial;
+
 	EGLImageKHR image;
 
 	struct wl_buffer *buffer;
@@ -498,6 +589,34 @@ weston_surface_activate(struct weston_surface *surface,
 void
 weston_surface_draw(struct weston_surface *es,
 		    struct weston_output *output, pixman_region32_t *damage);
+int
+weston_output_black_below(struct weston_output *output,
+			  struct weston_surface *es);
+
+int
+weston_compositor_read_pixels(struct weston_compositor *ec,
+			      int32_t x, int32_t y,
+			      int32_t width, int32_t height,
+			      uint8_t *dst, int32_t stride, uint8_t *tmp);
+
+/* An output composited into a texture rather than an EGL surface.
+ * pixels holds one read back rectangle. */
+struct weston_texture_target {
+	GLuint fbo, texture;
+	int32_t width, height;
+	uint8_t *pixels;
+};
+
+int
+weston_texture_target_init(struct weston_texture_target *target,
+			   int32_t width, int32_t height);
+void
+weston_texture_target_fini(struct weston_texture_target *target);
+void
+weston_texture_target_read(struct weston_compositor *ec,
+			   struct weston_texture_target *target,
+			   pixman_region32_t *region,
+			   uint8_t *dst, int32_t stride);
 
 void
 notify_motion(struct wl_seat *seat, uint32_t time,
@@ -528,6 +647,8 @@ notify_keyboard_focus_out(struct wl_seat *seat);
 void
 notify_touch(struct wl_seat *seat, uint32_t time, int touch_id,
 	     wl_fixed_t x, wl_fixed_t y, int touch_type);
+void
+notify_touch_frame(struct wl_seat *seat);
 
 void
 weston_layer_init(struct weston_layer *layer, struct wl_list *below);
@@ -597,7 +718,15 @@ void
 weston_binding_destroy(struct weston_binding *binding);
 
 void
-weston_binding_list_destroy_all(struct wl_list *list);
+weston_binding_table_init(struct weston_binding_table *table);
+
+void
+weston_binding_table_destroy_all(struct weston_binding_table *table);
+
+struct weston_binding *
+weston_binding_table_next(struct weston_binding_table *table,
+			  struct weston_binding *prev,
+			  uint32_t code, uint32_t modifier);
 
 void
 weston_compositor_run_key_binding(struct weston_compositor *compositor,
@@ -646,6 +775,10 @@ weston_surface_damage(struct weston_surface *surface);
 void
 weston_surface_damage_below(struct weston_surface *surface);
 
+uint32_t
+weston_surface_update_rate(struct weston_surface *surface, uint32_t msecs,
+			   uint32_t *updates);
+
 void
 weston_surface_unmap(struct weston_surface *surface);
 
@@ -711,6 +844,23 @@ tty_activate_vt(struct tty *tty, int vt);
 void
 screenshooter_create(struct weston_compositor *ec);
 
+void
+latency_create(struct weston_compositor *ec);
+
+void
+weston_latency_tag(struct timespec *tag, const struct timespec *input_time);
+
+void
+weston_output_latency_repaint(struct weston_output *output);
+
+void
+weston_output_latency_presented(struct weston_output *output);
+
+void
+weston_latency_record(struct weston_compositor *ec,
+		      enum weston_latency_path path,
+		      const struct timespec *input_time);
+
 struct clipboard *
 clipboard_create(struct weston_seat *seat);
 
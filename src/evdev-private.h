@@ -24,24 +24,106 @@
 #define EVDEV_PRIVATE_H
 
 #include <linux/input.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
 #include <wayland-util.h>
 
+/* Must be a power of two. */
+#define EVDEV_RING_SIZE 1024
+
+struct evdev_input_device;
+
+struct evdev_ring_entry {
+	struct evdev_input_device *device;
+	struct input_event event;
+};
+
+/* Devices are read on a dedicated thread, so that input is picked up
+ * from the kernel as soon as it arrives, even while the compositor is
+ * busy repainting.  The thread only reads; events are handed to the
+ * compositor through a single-producer, single-consumer ring and
+ * processed on the main thread when the ring is drained. */
+struct evdev_input_thread {
+	pthread_t thread;
+	int running;
+	int epoll_fd;
+	int wake_fd;		/* input thread -> compositor */
+	int quit_fd;		/* compositor -> input thread */
+	struct wl_event_source *wake_source;
+
+	/* Held by the input thread while it reads, and by the
+	 * compositor while it adds or removes devices. */
+	pthread_mutex_t mutex;
+
+	/* The input thread waits on space_cond, without holding mutex,
+	 * when the ring is full, until there is room or quit is set. */
+	pthread_mutex_t space_mutex;
+	pthread_cond_t space_cond;
+	int producer_waiting;
+	int quit;
+
+	struct evdev_ring_entry ring[EVDEV_RING_SIZE];
+	uint32_t head, tail;
+};
+
+/* Input recordings are a header followed by records, all in CPU
+ * endianness.  Every record starts with a struct evdev_record and
+ * is followed by size bytes of payload: a struct evdev_record_device
+ * when a device is added, nothing when it is removed and the
+ * struct input_event array of one read from the device otherwise. */
+#define EVDEV_RECORD_MAGIC	0x57455652	/* "WEVR" */
+#define EVDEV_RECORD_VERSION	1
+
+struct evdev_record_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+enum evdev_record_type {
+	EVDEV_RECORD_DEVICE_ADDED = 1,
+	EVDEV_RECORD_DEVICE_REMOVED,
+	EVDEV_RECORD_EVENTS,
+};
+
+struct evdev_record {
+	uint32_t type;
+	uint32_t device;
+	uint32_t size;
+};
+
+struct evdev_record_device {
+	uint32_t caps;
+	uint32_t is_mt;
+	uint32_t is_touchpad;
+	int32_t min_x, max_x, min_y, max_y;
+};
+
+struct evdev_replay;
+
 struct evdev_seat {
 	struct weston_seat base;
 	struct wl_list devices_list;
 	struct udev_monitor *udev_monitor;
 	struct wl_event_source *udev_monitor_source;
 	char *seat_id;
+	struct evdev_input_thread input_thread;
+	uint32_t next_device_id;
+	FILE *record;
+	struct evdev_replay *replay;
 };
 
 #define MAX_SLOTS 16
 
 enum evdev_event_type {
 	EVDEV_ABSOLUTE_MOTION = (1 << 0),
-	EVDEV_ABSOLUTE_MT_DOWN = (1 << 1),
-	EVDEV_ABSOLUTE_MT_MOTION = (1 << 2),
-	EVDEV_ABSOLUTE_MT_UP = (1 << 3),
-	EVDEV_RELATIVE_MOTION = (1 << 4),
+	EVDEV_RELATIVE_MOTION = (1 << 1),
+};
+
+enum evdev_slot_event {
+	EVDEV_SLOT_DOWN = (1 << 0),
+	EVDEV_SLOT_MOTION = (1 << 1),
+	EVDEV_SLOT_UP = (1 << 2),
 };
 
 enum evdev_device_capability {
@@ -60,15 +142,22 @@ struct evdev_input_device {
 	struct evdev_dispatch *dispatch;
 	char *devnode;
 	int fd;
+	uint32_t id;
 	struct {
 		int min_x, max_x, min_y, max_y;
 		int32_t x, y;
 	} abs;
 
+	/* Touch state is accumulated per slot and sent to the
+	 * compositor once per SYN_REPORT. */
 	struct {
 		int slot;
-		int32_t x[MAX_SLOTS];
-		int32_t y[MAX_SLOTS];
+		uint32_t dirty;		/* one bit per slot */
+		struct {
+			int32_t x, y;
+			int down;
+			enum evdev_slot_event pending;
+		} slots[MAX_SLOTS];
 	} mt;
 	struct mtdev *mtdev;
 
@@ -27,6 +27,7 @@
 
 #include "filter.h"
 #include "evdev-private.h"
+#include "log.h"
 
 /* Default values */
 #define DEFAULT_CONSTANT_ACCEL_NUMERATOR 50
@@ -188,6 +189,53 @@ touchpad_profile(struct weston_motion_filter *filter,
 	return accel_factor;
 }
 
+static void
+configure_touchpad_acceleration(struct touchpad_dispatch *touchpad,
+				double diagonal)
+{
+	char *config_file;
+	char *numerator = NULL;
+	char *min_factor = NULL;
+	char *max_factor = NULL;
+
+	struct config_key touchpad_keys[] = {
+		{ "constant-accel-numerator", CONFIG_KEY_STRING, &numerator },
+		{ "min-accel-factor",	CONFIG_KEY_STRING, &min_factor },
+		{ "max-accel-factor",	CONFIG_KEY_STRING, &max_factor },
+	};
+
+	struct config_section cs[] = {
+		{ "touchpad",
+		  touchpad_keys, ARRAY_LENGTH(touchpad_keys), NULL },
+	};
+
+	config_file = config_file_path("weston.ini");
+	parse_config_file(config_file, cs, ARRAY_LENGTH(cs), touchpad);
+	free(config_file);
+
+	touchpad->constant_accel_factor =
+		(numerator ? strtod(numerator, NULL) :
+			     DEFAULT_CONSTANT_ACCEL_NUMERATOR) / diagonal;
+	touchpad->min_accel_factor =
+		min_factor ? strtod(min_factor, NULL) :
+			     DEFAULT_MIN_ACCEL_FACTOR;
+	touchpad->max_accel_factor =
+		max_factor ? strtod(max_factor, NULL) :
+			     DEFAULT_MAX_ACCEL_FACTOR;
+
+	free(numerator);
+	free(min_factor);
+	free(max_factor);
+
+	if (touchpad->constant_accel_factor <= 0.0 ||
+	    touchpad->max_accel_factor <= 0.0) {
+		weston_log("touchpad: invalid acceleration, using defaults\n");
+		touchpad->constant_accel_factor =
+			DEFAULT_CONSTANT_ACCEL_NUMERATOR / diagonal;
+		touchpad->max_accel_factor = DEFAULT_MAX_ACCEL_FACTOR;
+	}
+}
+
 static void
 configure_touchpad(struct touchpad_dispatch *touchpad,
 		   struct evdev_input_device *device)
@@ -205,6 +253,7 @@ configure_touchpad(struct touchpad_dispatch *touchpad,
 	touchpad->model = get_touchpad_model(device);
 
 	/* Configure pressure */
+	memset(abs_bits, 0, sizeof abs_bits);
 	ioctl(device->fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits);
 	if (TEST_BIT(abs_bits, ABS_PRESSURE)) {
 		ioctl(device->fd, EVIOCGABS(ABS_PRESSURE), &absinfo);
@@ -218,11 +267,7 @@ configure_touchpad(struct touchpad_dispatch *touchpad,
 	height = abs(device->abs.max_y - device->abs.min_y);
 	diagonal = sqrt(width*width + height*height);
 
-	touchpad->constant_accel_factor =
-		DEFAULT_CONSTANT_ACCEL_NUMERATOR / diagonal;
-
-	touchpad->min_accel_factor = DEFAULT_MIN_ACCEL_FACTOR;
-	touchpad->max_accel_factor = DEFAULT_MAX_ACCEL_FACTOR;
+	configure_touchpad_acceleration(touchpad, diagonal);
 
 	touchpad->hysteresis.margin_x =
 	       	diagonal / DEFAULT_HYSTERESIS_MARGIN_DENOMINATOR;
@@ -231,9 +276,14 @@ configure_touchpad(struct touchpad_dispatch *touchpad,
 	touchpad->hysteresis.center_x = 0;
 	touchpad->hysteresis.center_y = 0;
 
-	/* Configure acceleration profile */
-	accel = create_pointer_accelator_filter(touchpad_profile);
-	wl_list_insert(&touchpad->motion_filters, &accel->link);
+	/* Configure acceleration profile.  It is constant past the
+	 * velocity where it reaches max_accel_factor, so the table
+	 * only needs to cover up to there. */
+	accel = create_pointer_accelator_table_filter(
+		touchpad_profile, touchpad,
+		touchpad->max_accel_factor / touchpad->constant_accel_factor);
+	if (accel)
+		wl_list_insert(&touchpad->motion_filters, &accel->link);
 
 	/* Setup initial state */
 	touchpad->reset = 1;
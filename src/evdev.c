@@ -20,11 +20,17 @@
  * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <linux/input.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <mtdev.h>
 
 #include "compositor.h"
@@ -100,32 +106,42 @@ evdev_process_touch(struct evdev_input_device *device,
 {
 	const int screen_width = device->output->current->width;
 	const int screen_height = device->output->current->height;
+	int slot = device->mt.slot;
 
-	switch (e->code) {
-	case ABS_MT_SLOT:
+	if (e->code == ABS_MT_SLOT) {
 		device->mt.slot = e->value;
-		break;
+		return;
+	}
+
+	if (slot < 0 || slot >= MAX_SLOTS)
+		return;
+
+	switch (e->code) {
 	case ABS_MT_TRACKING_ID:
 		if (e->value >= 0)
-			device->pending_events |= EVDEV_ABSOLUTE_MT_DOWN;
+			device->mt.slots[slot].pending |= EVDEV_SLOT_DOWN;
 		else
-			device->pending_events |= EVDEV_ABSOLUTE_MT_UP;
+			device->mt.slots[slot].pending |= EVDEV_SLOT_UP;
 		break;
 	case ABS_MT_POSITION_X:
-		device->mt.x[device->mt.slot] =
+		device->mt.slots[slot].x =
 			(e->value - device->abs.min_x) * screen_width /
 			(device->abs.max_x - device->abs.min_x) +
 			device->output->x;
-		device->pending_events |= EVDEV_ABSOLUTE_MT_MOTION;
+		device->mt.slots[slot].pending |= EVDEV_SLOT_MOTION;
 		break;
 	case ABS_MT_POSITION_Y:
-		device->mt.y[device->mt.slot] =
+		device->mt.slots[slot].y =
 			(e->value - device->abs.min_y) * screen_height /
 			(device->abs.max_y - device->abs.min_y) +
 			device->output->y;
-		device->pending_events |= EVDEV_ABSOLUTE_MT_MOTION;
+		device->mt.slots[slot].pending |= EVDEV_SLOT_MOTION;
 		break;
+	default:
+		return;
 	}
+
+	device->mt.dirty |= 1 << slot;
 }
 
 static inline void
@@ -192,74 +208,87 @@ evdev_process_absolute(struct evdev_input_device *device,
 	}
 }
 
-static int
-is_motion_event(struct input_event *e)
-{
-	switch (e->type) {
-	case EV_REL:
-		switch (e->code) {
-		case REL_X:
-		case REL_Y:
-			return 1;
-		}
-	case EV_ABS:
-		switch (e->code) {
-		case ABS_X:
-		case ABS_Y:
-		case ABS_MT_POSITION_X:
-		case ABS_MT_POSITION_Y:
-			return 1;
-		}
-	}
-
-	return 0;
-}
-
 static void
-evdev_flush_motion(struct evdev_input_device *device, uint32_t time)
+evdev_flush_pointer(struct evdev_input_device *device, uint32_t time)
 {
 	struct weston_seat *master = &device->master->base;
 
-	if (!device->pending_events)
-		return;
-
 	if (device->pending_events & EVDEV_RELATIVE_MOTION) {
 		notify_motion(&master->seat, time,
 			      master->seat.pointer->x + device->rel.dx,
 			      master->seat.pointer->y + device->rel.dy);
-		device->pending_events &= ~EVDEV_RELATIVE_MOTION;
 		device->rel.dx = 0;
 		device->rel.dy = 0;
 	}
-	if (device->pending_events & EVDEV_ABSOLUTE_MT_DOWN) {
-		notify_touch(&master->seat, time,
-			     device->mt.slot,
-			     wl_fixed_from_int(device->mt.x[device->mt.slot]),
-			     wl_fixed_from_int(device->mt.y[device->mt.slot]),
-			     WL_TOUCH_DOWN);
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_DOWN;
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_MOTION;
-	}
-	if (device->pending_events & EVDEV_ABSOLUTE_MT_MOTION) {
-		notify_touch(&master->seat, time,
-			     device->mt.slot,
-			     wl_fixed_from_int(device->mt.x[device->mt.slot]),
-			     wl_fixed_from_int(device->mt.y[device->mt.slot]),
-			     WL_TOUCH_MOTION);
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_DOWN;
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_MOTION;
-	}
-	if (device->pending_events & EVDEV_ABSOLUTE_MT_UP) {
-		notify_touch(&master->seat, time, device->mt.slot, 0, 0,
-			     WL_TOUCH_UP);
-		device->pending_events &= ~EVDEV_ABSOLUTE_MT_UP;
-	}
 	if (device->pending_events & EVDEV_ABSOLUTE_MOTION) {
 		notify_motion(&master->seat, time,
 			      wl_fixed_from_int(device->abs.x),
 			      wl_fixed_from_int(device->abs.y));
-		device->pending_events &= ~EVDEV_ABSOLUTE_MOTION;
 	}
+
+	device->pending_events = 0;
+}
+
+static void
+evdev_flush_touch(struct evdev_input_device *device, uint32_t time)
+{
+	struct wl_seat *seat = &device->master->base.seat;
+	enum evdev_slot_event pending;
+	uint32_t dirty = device->mt.dirty;
+	int i;
+
+	if (!dirty)
+		return;
+
+	for (i = 0; dirty; i++, dirty >>= 1) {
+		if (!(dirty & 1))
+			continue;
+
+		pending = device->mt.slots[i].pending;
+		device->mt.slots[i].pending = 0;
+
+		/* A contact that was down at the start of the frame and
+		 * has both an up and a down pending was lifted and
+		 * replaced by a new one, so the up goes first.
+		 * Otherwise the down goes first, which covers a contact
+		 * that came and went within one frame. */
+		if ((pending & EVDEV_SLOT_UP) && device->mt.slots[i].down) {
+			notify_touch(seat, time, i, 0, 0, WL_TOUCH_UP);
+			device->mt.slots[i].down = 0;
+			pending &= ~EVDEV_SLOT_UP;
+		}
+
+		if (pending & EVDEV_SLOT_DOWN) {
+			notify_touch(seat, time, i,
+				     wl_fixed_from_int(device->mt.slots[i].x),
+				     wl_fixed_from_int(device->mt.slots[i].y),
+				     WL_TOUCH_DOWN);
+			device->mt.slots[i].down = 1;
+		} else if ((pending & EVDEV_SLOT_MOTION) &&
+			   device->mt.slots[i].down) {
+			notify_touch(seat, time, i,
+				     wl_fixed_from_int(device->mt.slots[i].x),
+				     wl_fixed_from_int(device->mt.slots[i].y),
+				     WL_TOUCH_MOTION);
+		}
+
+		if ((pending & EVDEV_SLOT_UP) && device->mt.slots[i].down) {
+			notify_touch(seat, time, i, 0, 0, WL_TOUCH_UP);
+			device->mt.slots[i].down = 0;
+		}
+	}
+
+	device->mt.dirty = 0;
+	notify_touch_frame(seat);
+}
+
+/* Send everything accumulated since the last SYN_REPORT: the
+ * coalesced pointer motion and every touch point that changed. */
+static void
+evdev_flush_frame(struct evdev_input_device *device, uint32_t time)
+{
+	evdev_flush_pointer(device, time);
+	evdev_flush_touch(device, time);
 }
 
 static void
@@ -304,31 +333,126 @@ fallback_dispatch_create(void)
 	return dispatch;
 }
 
+static void
+evdev_record_write(struct evdev_input_device *device, uint32_t type,
+		   const void *data, uint32_t size)
+{
+	struct evdev_seat *seat = device->master;
+	struct evdev_record record;
+
+	/* Replayed devices have no fd and are not recorded again. */
+	if (seat->record == NULL || device->fd < 0)
+		return;
+
+	record.type = type;
+	record.device = device->id;
+	record.size = size;
+	if (fwrite(&record, sizeof record, 1, seat->record) != 1 ||
+	    (size > 0 && fwrite(data, size, 1, seat->record) != 1)) {
+		weston_log("evdev: failed to write input recording\n");
+		fclose(seat->record);
+		seat->record = NULL;
+	}
+}
+
+static void
+evdev_record_device_added(struct evdev_input_device *device)
+{
+	struct evdev_record_device rd;
+
+	rd.caps = device->caps;
+	rd.is_mt = device->is_mt;
+	rd.is_touchpad = device->dispatch->interface != &fallback_interface;
+	rd.min_x = device->abs.min_x;
+	rd.max_x = device->abs.max_x;
+	rd.min_y = device->abs.min_y;
+	rd.max_y = device->abs.max_y;
+
+	evdev_record_write(device, EVDEV_RECORD_DEVICE_ADDED, &rd, sizeof rd);
+}
+
+/* Kernel event timestamps are on CLOCK_REALTIME, the clock clients
+ * get them on.  The latency tag is the same instant on
+ * CLOCK_MONOTONIC, found with the current offset between the two. */
+static void
+evdev_event_monotonic_time(const struct input_event *e, int64_t offset_ns,
+			   struct timespec *ts)
+{
+	int64_t t;
+
+	t = e->time.tv_sec * 1000000000LL + e->time.tv_usec * 1000LL +
+		offset_ns;
+
+	ts->tv_sec = t / 1000000000;
+	ts->tv_nsec = t % 1000000000;
+}
+
+/* Replayed events aren't traced, since their timestamps are made up. */
 static void
 evdev_process_events(struct evdev_input_device *device,
-		     struct input_event *ev, int count)
+		     struct input_event *ev, int count, int replayed)
 {
 	struct evdev_dispatch *dispatch = device->dispatch;
+	struct weston_seat *seat = &device->master->base;
 	struct input_event *e, *end;
-	uint32_t time = 0;
-
-	device->pending_events = 0;
-
-	e = ev;
-	end = e + count;
+	struct timespec mono, real;
+	int64_t offset_ns;
+	uint32_t time;
+
+	evdev_record_write(device, EVDEV_RECORD_EVENTS, ev, count * sizeof *ev);
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	offset_ns = (mono.tv_sec - real.tv_sec) * 1000000000LL +
+		mono.tv_nsec - real.tv_nsec;
+
+	seat->input_time.tv_sec = 0;
+	seat->input_time.tv_nsec = 0;
+
+	/* Motion and touch state is accumulated on the device and sent
+	 * to the compositor once per kernel event frame, when the
+	 * SYN_REPORT that ends it arrives.  A frame may be split
+	 * across reads, so nothing is flushed at the end of the
+	 * batch. */
+	end = ev + count;
 	for (e = ev; e < end; e++) {
 		time = e->time.tv_sec * 1000 + e->time.tv_usec / 1000;
+		if (!replayed)
+			evdev_event_monotonic_time(e, offset_ns,
+						   &seat->input_time);
 
-		/* we try to minimize the amount of notifications to be
-		 * forwarded to the compositor, so we accumulate motion
-		 * events and send as a bunch */
-		if (!is_motion_event(e))
-			evdev_flush_motion(device, time);
+		/* Buttons and scrolling apply at the pointer position
+		 * the preceding events moved it to. */
+		if (e->type == EV_KEY ||
+		    (e->type == EV_REL &&
+		     e->code != REL_X && e->code != REL_Y))
+			evdev_flush_pointer(device, time);
 
 		dispatch->interface->process(dispatch, device, e, time);
+
+		if (e->type == EV_SYN && e->code == SYN_REPORT)
+			evdev_flush_frame(device, time);
 	}
+}
+
+/* Read what is available on the device fd into ev, returning the number
+ * of events or -1 on error. */
+static int
+evdev_input_device_read(struct evdev_input_device *device,
+			struct input_event *ev, int count)
+{
+	int len;
+
+	if (device->mtdev)
+		len = mtdev_get(device->mtdev, device->fd, ev, count) *
+			sizeof (struct input_event);
+	else
+		len = read(device->fd, ev, count * sizeof ev[0]);
+
+	if (len < 0 || len % sizeof ev[0] != 0)
+		return -1;
 
-	evdev_flush_motion(device, time);
+	return len / sizeof ev[0];
 }
 
 static int
@@ -337,7 +461,7 @@ evdev_input_device_data(int fd, uint32_t mask, void *data)
 	struct weston_compositor *ec;
 	struct evdev_input_device *device = data;
 	struct input_event ev[32];
-	int len;
+	int count;
 
 	ec = device->master->base.compositor;
 	if (!ec->focus)
@@ -347,25 +471,308 @@ evdev_input_device_data(int fd, uint32_t mask, void *data)
 	 * per frame and we have to process all the events available on the
 	 * fd, otherwise there will be input lag. */
 	do {
-		if (device->mtdev)
-			len = mtdev_get(device->mtdev, fd, ev,
-					ARRAY_LENGTH(ev)) *
-				sizeof (struct input_event);
-		else
-			len = read(fd, &ev, sizeof ev);
-
-		if (len < 0 || len % sizeof ev[0] != 0) {
+		count = evdev_input_device_read(device, ev, ARRAY_LENGTH(ev));
+		if (count < 0) {
 			/* FIXME: call device_removed when errno is ENODEV. */
 			return 1;
 		}
 
-		evdev_process_events(device, ev, len / sizeof ev[0]);
+		evdev_process_events(device, ev, count, 0);
 
-	} while (len > 0);
+	} while (count > 0);
 
 	return 1;
 }
 
+/* Hand all events in the ring to the compositor, keeping runs of events
+ * from one device together so that motion is still accumulated. */
+static void
+evdev_input_thread_drain(struct evdev_seat *seat)
+{
+	struct evdev_input_thread *t = &seat->input_thread;
+	struct weston_compositor *ec = seat->base.compositor;
+	struct evdev_input_device *device;
+	struct evdev_ring_entry *entry;
+	struct input_event ev[32];
+	uint32_t head, tail;
+	int count;
+
+	head = t->head;
+	__sync_synchronize();
+	tail = t->tail;
+
+	device = NULL;
+	count = 0;
+	while (tail != head) {
+		entry = &t->ring[tail & (EVDEV_RING_SIZE - 1)];
+		if (count > 0 &&
+		    (entry->device != device || count == ARRAY_LENGTH(ev))) {
+			if (ec->focus)
+				evdev_process_events(device, ev, count, 0);
+			count = 0;
+		}
+		device = entry->device;
+		ev[count++] = entry->event;
+		tail++;
+	}
+	if (count > 0 && ec->focus)
+		evdev_process_events(device, ev, count, 0);
+
+	__sync_synchronize();
+	t->tail = tail;
+	__sync_synchronize();
+
+	if (t->producer_waiting) {
+		pthread_mutex_lock(&t->space_mutex);
+		pthread_cond_signal(&t->space_cond);
+		pthread_mutex_unlock(&t->space_mutex);
+	}
+}
+
+/* The input thread only holds its lock for reads that can't block
+ * and never waits for room in the ring with it, so this blocks for at
+ * most one batch of reads. */
+static void
+evdev_input_thread_lock(struct evdev_seat *seat)
+{
+	pthread_mutex_lock(&seat->input_thread.mutex);
+}
+
+static int
+evdev_input_thread_wake(int fd, uint32_t mask, void *data)
+{
+	struct evdev_seat *seat = data;
+	uint64_t value;
+
+	read(fd, &value, sizeof value);
+	evdev_input_thread_drain(seat);
+
+	return 1;
+}
+
+static int
+evdev_input_thread_has_room(struct evdev_input_thread *t, int count)
+{
+	__sync_synchronize();
+
+	return EVDEV_RING_SIZE - (t->head - t->tail) >= (uint32_t) count;
+}
+
+/* Wait, without the lock, until the ring has room for count events.
+ * Returns -1 if the thread is asked to quit meanwhile. */
+static int
+evdev_input_thread_wait_for_room(struct evdev_input_thread *t, int count)
+{
+	uint64_t one = 1;
+	int quit;
+
+	if (evdev_input_thread_has_room(t, count))
+		return 0;
+
+	/* The compositor is behind; make sure it knows there is work
+	 * and wait for it to make room. */
+	write(t->wake_fd, &one, sizeof one);
+	pthread_mutex_lock(&t->space_mutex);
+	t->producer_waiting = 1;
+	while (!evdev_input_thread_has_room(t, count) && !t->quit)
+		pthread_cond_wait(&t->space_cond, &t->space_mutex);
+	t->producer_waiting = 0;
+	quit = t->quit;
+	pthread_mutex_unlock(&t->space_mutex);
+
+	return quit ? -1 : 0;
+}
+
+/* The caller has made sure there is room for count events. */
+static void
+evdev_input_thread_push(struct evdev_input_thread *t,
+			struct evdev_input_device *device,
+			struct input_event *ev, int count)
+{
+	struct evdev_ring_entry *entry;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		entry = &t->ring[t->head & (EVDEV_RING_SIZE - 1)];
+		entry->device = device;
+		entry->event = ev[i];
+		__sync_synchronize();
+		t->head++;
+	}
+}
+
+static void *
+evdev_input_thread_func(void *data)
+{
+	struct evdev_seat *seat = data;
+	struct evdev_input_thread *t = &seat->input_thread;
+	struct evdev_input_device *device;
+	struct epoll_event events[16];
+	struct input_event ev[32];
+	uint64_t one = 1;
+	int i, n, count;
+
+	for (;;) {
+		/* Devices are only read while a whole batch fits in the
+		 * ring; epoll reports the ones left unread again. */
+		if (evdev_input_thread_wait_for_room(t, ARRAY_LENGTH(ev)) < 0)
+			return NULL;
+
+		n = epoll_wait(t->epoll_fd, events, ARRAY_LENGTH(events), -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		pthread_mutex_lock(&t->mutex);
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == t->quit_fd) {
+				pthread_mutex_unlock(&t->mutex);
+				return NULL;
+			}
+
+			/* The device may have been removed since
+			 * epoll_wait() returned, so look it up again
+			 * now that we hold the lock. */
+			wl_list_for_each(device, &seat->devices_list, link)
+				if (device->fd == events[i].data.fd)
+					break;
+			if (&device->link == &seat->devices_list)
+				continue;
+
+			count = 0;
+			while (evdev_input_thread_has_room(t,
+							   ARRAY_LENGTH(ev))) {
+				count = evdev_input_device_read(device, ev,
+							ARRAY_LENGTH(ev));
+				if (count <= 0)
+					break;
+				evdev_input_thread_push(t, device, ev, count);
+			}
+
+			/* Stop polling an unplugged device until udev
+			 * tells the compositor to remove it. */
+			if (count < 0 && errno == ENODEV)
+				epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL,
+					  device->fd, NULL);
+		}
+		pthread_mutex_unlock(&t->mutex);
+
+		write(t->wake_fd, &one, sizeof one);
+	}
+
+	return NULL;
+}
+
+static int
+evdev_input_thread_start(struct evdev_seat *seat)
+{
+	struct evdev_input_thread *t = &seat->input_thread;
+	struct weston_compositor *ec = seat->base.compositor;
+	struct epoll_event ep;
+
+	t->running = 0;
+	t->head = 0;
+	t->tail = 0;
+	t->producer_waiting = 0;
+	t->quit = 0;
+
+	t->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (t->epoll_fd < 0)
+		goto err0;
+
+	t->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (t->wake_fd < 0)
+		goto err1;
+
+	t->quit_fd = eventfd(0, EFD_CLOEXEC);
+	if (t->quit_fd < 0)
+		goto err2;
+
+	memset(&ep, 0, sizeof ep);
+	ep.events = EPOLLIN;
+	ep.data.fd = t->quit_fd;
+	if (epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, t->quit_fd, &ep) < 0)
+		goto err3;
+
+	t->wake_source = wl_event_loop_add_fd(ec->input_loop, t->wake_fd,
+					      WL_EVENT_READABLE,
+					      evdev_input_thread_wake, seat);
+	if (t->wake_source == NULL)
+		goto err3;
+
+	pthread_mutex_init(&t->mutex, NULL);
+	pthread_mutex_init(&t->space_mutex, NULL);
+	pthread_cond_init(&t->space_cond, NULL);
+
+	if (pthread_create(&t->thread, NULL,
+			   evdev_input_thread_func, seat) != 0)
+		goto err4;
+
+	t->running = 1;
+
+	return 0;
+
+err4:
+	pthread_cond_destroy(&t->space_cond);
+	pthread_mutex_destroy(&t->space_mutex);
+	pthread_mutex_destroy(&t->mutex);
+	wl_event_source_remove(t->wake_source);
+err3:
+	close(t->quit_fd);
+err2:
+	close(t->wake_fd);
+err1:
+	close(t->epoll_fd);
+err0:
+	weston_log("failed to start input thread, "
+		   "reading input on the main loop\n");
+	return -1;
+}
+
+static void
+evdev_input_thread_stop(struct evdev_seat *seat)
+{
+	struct evdev_input_thread *t = &seat->input_thread;
+	uint64_t one = 1;
+
+	if (!t->running)
+		return;
+
+	/* The thread is either in epoll_wait(), which quit_fd wakes, or
+	 * waiting for room in the ring, which quit ends. */
+	write(t->quit_fd, &one, sizeof one);
+	pthread_mutex_lock(&t->space_mutex);
+	t->quit = 1;
+	pthread_cond_signal(&t->space_cond);
+	pthread_mutex_unlock(&t->space_mutex);
+
+	pthread_join(t->thread, NULL);
+	evdev_input_thread_drain(seat);
+	t->running = 0;
+
+	pthread_cond_destroy(&t->space_cond);
+	pthread_mutex_destroy(&t->space_mutex);
+	pthread_mutex_destroy(&t->mutex);
+	wl_event_source_remove(t->wake_source);
+	close(t->quit_fd);
+	close(t->wake_fd);
+	close(t->epoll_fd);
+}
+
+static void
+evdev_init_seat_capabilities(struct evdev_input_device *device)
+{
+	if ((device->caps &
+	     (EVDEV_MOTION_ABS | EVDEV_MOTION_REL | EVDEV_BUTTON)))
+		weston_seat_init_pointer(&device->master->base);
+	if ((device->caps & EVDEV_KEYBOARD))
+		weston_seat_init_keyboard(&device->master->base, NULL);
+	if ((device->caps & EVDEV_TOUCH))
+		weston_seat_init_touch(&device->master->base);
+}
+
 static int
 evdev_configure_device(struct evdev_input_device *device)
 {
@@ -444,13 +851,7 @@ evdev_configure_device(struct evdev_input_device *device)
 	if (has_abs && !has_key)
 		return -1;
 
-	if ((device->caps &
-	     (EVDEV_MOTION_ABS | EVDEV_MOTION_REL | EVDEV_BUTTON)))
-		weston_seat_init_pointer(&device->master->base);
-	if ((device->caps & EVDEV_KEYBOARD))
-		weston_seat_init_keyboard(&device->master->base, NULL);
-	if ((device->caps & EVDEV_TOUCH))
-		weston_seat_init_touch(&device->master->base);
+	evdev_init_seat_capabilities(device);
 
 	return 0;
 }
@@ -461,6 +862,7 @@ evdev_input_device_create(struct evdev_seat *master,
 {
 	struct evdev_input_device *device;
 	struct weston_compositor *ec;
+	struct epoll_event ep;
 
 	device = malloc(sizeof *device);
 	if (device == NULL)
@@ -471,12 +873,16 @@ evdev_input_device_create(struct evdev_seat *master,
 		container_of(ec->output_list.next, struct weston_output, link);
 
 	device->master = master;
+	device->id = master->next_device_id++;
 	device->is_mt = 0;
 	device->mtdev = NULL;
 	device->devnode = strdup(path);
 	device->mt.slot = -1;
+	device->mt.dirty = 0;
+	memset(device->mt.slots, 0, sizeof device->mt.slots);
 	device->rel.dx = 0;
 	device->rel.dy = 0;
+	device->pending_events = 0;
 	device->dispatch = NULL;
 
 	/* Use non-blocking mode so that we can loop on read on
@@ -495,6 +901,7 @@ evdev_input_device_create(struct evdev_seat *master,
 	if (device->dispatch == NULL)
 		goto err1;
 
+	evdev_record_device_added(device);
 
 	if (device->is_mt) {
 		device->mtdev = mtdev_new_open(device->fd);
@@ -502,6 +909,25 @@ evdev_input_device_create(struct evdev_seat *master,
 			weston_log("mtdev failed to open for %s\n", path);
 	}
 
+	if (master->input_thread.running) {
+		memset(&ep, 0, sizeof ep);
+		ep.events = EPOLLIN;
+		ep.data.fd = device->fd;
+
+		evdev_input_thread_lock(master);
+		wl_list_insert(master->devices_list.prev, &device->link);
+		if (epoll_ctl(master->input_thread.epoll_fd, EPOLL_CTL_ADD,
+			      device->fd, &ep) < 0) {
+			wl_list_remove(&device->link);
+			pthread_mutex_unlock(&master->input_thread.mutex);
+			goto err2;
+		}
+		pthread_mutex_unlock(&master->input_thread.mutex);
+		device->source = NULL;
+
+		return device;
+	}
+
 	device->source = wl_event_loop_add_fd(ec->input_loop, device->fd,
 					      WL_EVENT_READABLE,
 					      evdev_input_device_data, device);
@@ -513,6 +939,8 @@ evdev_input_device_create(struct evdev_seat *master,
 	return device;
 
 err2:
+	if (device->mtdev)
+		mtdev_close_delete(device->mtdev);
 	device->dispatch->interface->destroy(device->dispatch);
 err1:
 	close(device->fd);
@@ -546,14 +974,29 @@ device_added(struct udev_device *udev_device, struct evdev_seat *master)
 static void
 device_removed(struct evdev_input_device *device)
 {
+	struct evdev_input_thread *t = &device->master->input_thread;
 	struct evdev_dispatch *dispatch;
 
+	evdev_record_write(device, EVDEV_RECORD_DEVICE_REMOVED, NULL, 0);
+
+	if (t->running) {
+		/* Once we hold the lock the thread can't be reading the
+		 * device, and after the drain the ring no longer refers
+		 * to it. */
+		evdev_input_thread_lock(device->master);
+		epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL, device->fd, NULL);
+		wl_list_remove(&device->link);
+		evdev_input_thread_drain(device->master);
+		pthread_mutex_unlock(&t->mutex);
+	} else {
+		wl_event_source_remove(device->source);
+		wl_list_remove(&device->link);
+	}
+
 	dispatch = device->dispatch;
 	if (dispatch)
 		dispatch->interface->destroy(dispatch);
 
-	wl_event_source_remove(device->source);
-	wl_list_remove(&device->link);
 	if (device->mtdev)
 		mtdev_close_delete(device->mtdev);
 	close(device->fd);
@@ -727,6 +1170,299 @@ evdev_disable_udev_monitor(struct weston_seat *seat_base)
 	seat->udev_monitor_source = NULL;
 }
 
+int
+evdev_input_record(struct weston_seat *seat_base, const char *path)
+{
+	struct evdev_seat *seat = (struct evdev_seat *) seat_base;
+	struct evdev_record_header header;
+	struct evdev_input_device *device;
+
+	seat->record = fopen(path, "w");
+	if (seat->record == NULL) {
+		weston_log("evdev: failed to open %s: %m\n", path);
+		return -1;
+	}
+
+	header.magic = EVDEV_RECORD_MAGIC;
+	header.version = EVDEV_RECORD_VERSION;
+	if (fwrite(&header, sizeof header, 1, seat->record) != 1) {
+		weston_log("evdev: failed to write %s\n", path);
+		fclose(seat->record);
+		seat->record = NULL;
+		return -1;
+	}
+
+	wl_list_for_each(device, &seat->devices_list, link)
+		evdev_record_device_added(device);
+
+	weston_log("evdev: recording input to %s\n", path);
+
+	return 0;
+}
+
+/* A recording is replayed by devices that have no fd and are fed from
+ * a timer, through the same evdev_process_events() path as live input.
+ * Event timestamps are moved to the time of the replay: an event
+ * recorded t ms after the first one is stamped t / speed ms after the
+ * replay started, which is when it is played back. */
+struct evdev_replay {
+	struct evdev_seat *seat;
+	struct wl_event_source *timer;
+	struct wl_list devices;
+	char *data, *p, *end;
+	int speed;
+	uint32_t start_time;
+	uint32_t first_event;
+	int started;
+	uint32_t events;
+};
+
+static struct evdev_input_device *
+evdev_replay_device_create(struct evdev_replay *replay, uint32_t id,
+			   struct evdev_record_device *rd)
+{
+	struct evdev_seat *master = replay->seat;
+	struct weston_compositor *ec = master->base.compositor;
+	struct evdev_input_device *device;
+
+	device = malloc(sizeof *device);
+	if (device == NULL)
+		return NULL;
+
+	memset(device, 0, sizeof *device);
+	device->output =
+		container_of(ec->output_list.next, struct weston_output, link);
+	device->master = master;
+	device->id = id;
+	device->fd = -1;
+	device->devnode = strdup("replay");
+	device->caps = rd->caps;
+	device->is_mt = rd->is_mt;
+	device->mt.slot = rd->is_mt ? 0 : -1;
+	device->abs.min_x = rd->min_x;
+	device->abs.max_x = rd->max_x;
+	device->abs.min_y = rd->min_y;
+	device->abs.max_y = rd->max_y;
+
+	if (rd->is_touchpad)
+		device->dispatch = evdev_touchpad_create(device);
+	else
+		device->dispatch = fallback_dispatch_create();
+	if (device->dispatch == NULL) {
+		free(device->devnode);
+		free(device);
+		return NULL;
+	}
+
+	evdev_init_seat_capabilities(device);
+	wl_list_insert(replay->devices.prev, &device->link);
+
+	return device;
+}
+
+static void
+evdev_replay_device_destroy(struct evdev_input_device *device)
+{
+	wl_list_remove(&device->link);
+	device->dispatch->interface->destroy(device->dispatch);
+	free(device->devnode);
+	free(device);
+}
+
+static void
+evdev_replay_destroy(struct evdev_replay *replay)
+{
+	struct evdev_input_device *device, *next;
+
+	wl_list_for_each_safe(device, next, &replay->devices, link)
+		evdev_replay_device_destroy(device);
+
+	wl_event_source_remove(replay->timer);
+	replay->seat->replay = NULL;
+	free(replay->data);
+	free(replay);
+}
+
+static void
+evdev_replay_events(struct evdev_replay *replay,
+		    struct evdev_input_device *device,
+		    const char *data, uint32_t count)
+{
+	struct input_event ev[32];
+	uint32_t i, n, time;
+
+	/* The payload is not necessarily aligned for struct input_event. */
+	while (count > 0) {
+		n = count < ARRAY_LENGTH(ev) ? count : ARRAY_LENGTH(ev);
+		memcpy(ev, data, n * sizeof ev[0]);
+		for (i = 0; i < n; i++) {
+			time = ev[i].time.tv_sec * 1000 +
+				ev[i].time.tv_usec / 1000;
+			time = replay->start_time +
+				(time - replay->first_event) / replay->speed;
+			ev[i].time.tv_sec = time / 1000;
+			ev[i].time.tv_usec = (time % 1000) * 1000;
+		}
+		evdev_process_events(device, ev, n, 1);
+		data += n * sizeof ev[0];
+		count -= n;
+	}
+}
+
+static int
+evdev_replay_timer(void *data)
+{
+	struct evdev_replay *replay = data;
+	struct evdev_input_device *device, *d;
+	struct evdev_record record;
+	struct evdev_record_device rd;
+	struct input_event first;
+	uint32_t elapsed, time, count;
+	const char *payload;
+
+	elapsed = (weston_compositor_get_time() - replay->start_time) *
+		replay->speed;
+
+	while ((size_t) (replay->end - replay->p) >= sizeof record) {
+		memcpy(&record, replay->p, sizeof record);
+		payload = replay->p + sizeof record;
+		if (record.size > (size_t) (replay->end - payload)) {
+			weston_log("evdev: input recording is truncated\n");
+			break;
+		}
+
+		device = NULL;
+		wl_list_for_each(d, &replay->devices, link)
+			if (d->id == record.device)
+				device = d;
+
+		switch (record.type) {
+		case EVDEV_RECORD_DEVICE_ADDED:
+			if (device || record.size < sizeof rd)
+				break;
+			memcpy(&rd, payload, sizeof rd);
+			evdev_replay_device_create(replay, record.device, &rd);
+			break;
+		case EVDEV_RECORD_DEVICE_REMOVED:
+			if (device)
+				evdev_replay_device_destroy(device);
+			break;
+		case EVDEV_RECORD_EVENTS:
+			count = record.size / sizeof first;
+			if (count == 0)
+				break;
+
+			memcpy(&first, payload, sizeof first);
+			time = first.time.tv_sec * 1000 +
+				first.time.tv_usec / 1000;
+			if (!replay->started) {
+				replay->first_event = time;
+				replay->started = 1;
+			}
+
+			if (time - replay->first_event > elapsed) {
+				time = (time - replay->first_event - elapsed) /
+					replay->speed;
+				wl_event_source_timer_update(replay->timer,
+							     time ? time : 1);
+				return 1;
+			}
+
+			if (device) {
+				evdev_replay_events(replay, device,
+						    payload, count);
+				replay->events += count;
+			}
+			break;
+		}
+
+		replay->p = (char *) payload + record.size;
+	}
+
+	weston_log("evdev: replayed %u events in %u ms\n", replay->events,
+		   weston_compositor_get_time() - replay->start_time);
+	evdev_replay_destroy(replay);
+
+	return 1;
+}
+
+int
+evdev_input_replay(struct weston_seat *seat_base, const char *path, int speed)
+{
+	struct evdev_seat *seat = (struct evdev_seat *) seat_base;
+	struct weston_compositor *ec = seat->base.compositor;
+	struct evdev_record_header header;
+	struct evdev_replay *replay;
+	struct wl_event_loop *loop;
+	FILE *fp;
+	long size;
+
+	if (seat->replay)
+		return -1;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		weston_log("evdev: failed to open %s: %m\n", path);
+		return -1;
+	}
+
+	replay = malloc(sizeof *replay);
+	if (replay == NULL)
+		goto err_file;
+	memset(replay, 0, sizeof *replay);
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+
+	if (size < (long) sizeof header ||
+	    fread(&header, sizeof header, 1, fp) != 1 ||
+	    header.magic != EVDEV_RECORD_MAGIC ||
+	    header.version != EVDEV_RECORD_VERSION) {
+		weston_log("evdev: %s is not an input recording\n", path);
+		goto err_replay;
+	}
+
+	/* Load it all up front, so that replay doesn't wait on the disk. */
+	size -= sizeof header;
+	replay->data = malloc(size ? size : 1);
+	if (replay->data == NULL ||
+	    (size > 0 && fread(replay->data, size, 1, fp) != 1))
+		goto err_data;
+	fclose(fp);
+
+	loop = wl_display_get_event_loop(ec->wl_display);
+	replay->timer = wl_event_loop_add_timer(loop, evdev_replay_timer,
+						replay);
+	if (replay->timer == NULL) {
+		free(replay->data);
+		free(replay);
+		return -1;
+	}
+
+	replay->seat = seat;
+	replay->p = replay->data;
+	replay->end = replay->data + size;
+	replay->speed = speed > 0 ? speed : 1;
+	replay->start_time = weston_compositor_get_time();
+	wl_list_init(&replay->devices);
+	seat->replay = replay;
+
+	wl_event_source_timer_update(replay->timer, 1);
+
+	weston_log("evdev: replaying %s at %dx speed\n", path, replay->speed);
+
+	return 0;
+
+err_data:
+	free(replay->data);
+err_replay:
+	free(replay);
+err_file:
+	fclose(fp);
+	return -1;
+}
+
 void
 evdev_input_create(struct weston_compositor *c, struct udev *udev,
 		   const char *seat_id)
@@ -749,6 +1485,8 @@ evdev_input_create(struct weston_compositor *c, struct udev *udev,
 		return;
 	}
 
+	evdev_input_thread_start(seat);
+
 	evdev_add_devices(udev, &seat->base);
 
 	c->seat = &seat->base;
@@ -771,8 +1509,13 @@ evdev_input_destroy(struct weston_seat *seat_base)
 {
 	struct evdev_seat *seat = (struct evdev_seat *) seat_base;
 
+	if (seat->replay)
+		evdev_replay_destroy(seat->replay);
 	evdev_remove_devices(seat_base);
 	evdev_disable_udev_monitor(&seat->base);
+	evdev_input_thread_stop(seat);
+	if (seat->record)
+		fclose(seat->record);
 
 	wl_list_remove(&seat->base.link);
 	free(seat->seat_id);
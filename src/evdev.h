@@ -35,6 +35,12 @@ evdev_input_create(struct weston_compositor *c, struct udev *udev,
 void
 evdev_input_destroy(struct weston_seat *seat);
 
+int
+evdev_input_record(struct weston_seat *seat, const char *path);
+
+int
+evdev_input_replay(struct weston_seat *seat, const char *path, int speed);
+
 int
 evdev_enable_udev_monitor(struct udev *udev, struct weston_seat *seat_base);
 
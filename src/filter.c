@@ -46,24 +46,39 @@ weston_filter_dispatch(struct weston_motion_filter *filter,
 #define MOTION_TIMEOUT		300 /* (ms) */
 #define NUM_POINTER_TRACKERS	16
 
+/* Number of intervals the velocity range of a profile table is split
+ * into.  The profile is linearly interpolated between them. */
+#define ACCEL_TABLE_SIZE	128
+
+/* Each tracker remembers where the pointer was when it was created;
+ * the motion since then is the difference to the current position. */
 struct pointer_tracker {
-	double dx;
-	double dy;
+	double x;
+	double y;
 	uint32_t time;
 	int dir;
 };
 
+/* An acceleration profile sampled at ACCEL_TABLE_SIZE + 1 evenly spaced
+ * velocities. */
+struct accel_table {
+	double scale;		/* table intervals per unit of velocity */
+	double factor[ACCEL_TABLE_SIZE + 1];
+};
+
 struct pointer_accelerator;
 struct pointer_accelerator {
 	struct weston_motion_filter base;
 
 	accel_profile_func_t profile;
+	struct accel_table *table;
 
 	double velocity;
 	double last_velocity;
 	int last_dx;
 	int last_dy;
 
+	double x, y;
 	struct pointer_tracker *trackers;
 	int cur_tracker;
 };
@@ -131,21 +146,20 @@ feed_trackers(struct pointer_accelerator *accel,
 	      double dx, double dy,
 	      uint32_t time)
 {
-	int i, current;
-	struct pointer_tracker *trackers = accel->trackers;
+	struct pointer_tracker *tracker;
+	int current;
 
-	for (i = 0; i < NUM_POINTER_TRACKERS; i++) {
-		trackers[i].dx += dx;
-		trackers[i].dy += dy;
-	}
+	accel->x += dx;
+	accel->y += dy;
 
 	current = (accel->cur_tracker + 1) % NUM_POINTER_TRACKERS;
 	accel->cur_tracker = current;
 
-	trackers[current].dx = 0.0;
-	trackers[current].dy = 0.0;
-	trackers[current].time = time;
-	trackers[current].dir = get_direction(dx, dy);
+	tracker = &accel->trackers[current];
+	tracker->x = accel->x;
+	tracker->y = accel->y;
+	tracker->time = time;
+	tracker->dir = get_direction(dx, dy);
 }
 
 static struct pointer_tracker *
@@ -158,14 +172,15 @@ tracker_by_offset(struct pointer_accelerator *accel, unsigned int offset)
 }
 
 static double
-calculate_tracker_velocity(struct pointer_tracker *tracker, uint32_t time)
+calculate_tracker_velocity(struct pointer_accelerator *accel,
+			   struct pointer_tracker *tracker, uint32_t time)
 {
 	int dx;
 	int dy;
 	double distance;
 
-	dx = tracker->dx;
-	dy = tracker->dy;
+	dx = accel->x - tracker->x;
+	dy = accel->y - tracker->y;
 	distance = sqrt(dx*dx + dy*dy);
 	return distance / (double)(time - tracker->time);
 }
@@ -173,12 +188,12 @@ calculate_tracker_velocity(struct pointer_tracker *tracker, uint32_t time)
 static double
 calculate_velocity(struct pointer_accelerator *accel, uint32_t time)
 {
-	struct pointer_tracker *tracker;
-	double velocity;
+	struct pointer_tracker *tracker, *found = NULL;
 	double result = 0.0;
-	double initial_velocity;
-	double velocity_diff;
+	double initial_velocity = 0.0;
+	double low, high, distance2, dt;
 	unsigned int offset;
+	int dx, dy;
 
 	unsigned int dir = tracker_by_offset(accel, 0)->dir;
 
@@ -190,19 +205,23 @@ calculate_velocity(struct pointer_accelerator *accel, uint32_t time)
 			continue;
 
 		result = initial_velocity =
-			calculate_tracker_velocity(tracker, time);
+			calculate_tracker_velocity(accel, tracker, time);
 		if (initial_velocity > 0.0)
 			break;
 	}
 
 	/* Find least recent vector within a timelimit, maximum velocity diff
-	 * and direction threshold. */
+	 * and direction threshold.  The velocity limits are checked
+	 * against squared distances, so that only the vector found needs
+	 * a square root. */
+	low = initial_velocity - MAX_VELOCITY_DIFF;
+	high = initial_velocity + MAX_VELOCITY_DIFF;
 	for (; offset < NUM_POINTER_TRACKERS; offset++) {
 		tracker = tracker_by_offset(accel, offset);
 
 		/* Stop if too far away in time */
 		if (time - tracker->time > MOTION_TIMEOUT ||
-		    tracker->time > time)
+		    tracker->time >= time)
 			break;
 
 		/* Stop if direction changed */
@@ -210,16 +229,22 @@ calculate_velocity(struct pointer_accelerator *accel, uint32_t time)
 		if (dir == 0)
 			break;
 
-		velocity = calculate_tracker_velocity(tracker, time);
+		dx = accel->x - tracker->x;
+		dy = accel->y - tracker->y;
+		distance2 = dx*dx + dy*dy;
+		dt = time - tracker->time;
 
 		/* Stop if velocity differs too much from initial */
-		velocity_diff = fabs(initial_velocity - velocity);
-		if (velocity_diff > MAX_VELOCITY_DIFF)
+		if (distance2 > high * high * dt * dt ||
+		    (low > 0.0 && distance2 < low * low * dt * dt))
 			break;
 
-		result = velocity;
+		found = tracker;
 	}
 
+	if (found)
+		result = calculate_tracker_velocity(accel, found, time);
+
 	return result;
 }
 
@@ -250,6 +275,41 @@ calculate_acceleration(struct pointer_accelerator *accel,
 	return factor;
 }
 
+/* The profile, linearly interpolated from the table and held constant
+ * past its end. */
+static double
+accel_table_factor(struct accel_table *table, double velocity)
+{
+	double x = velocity * table->scale;
+	int i;
+
+	if (x <= 0.0)
+		return table->factor[0];
+	if (x >= ACCEL_TABLE_SIZE)
+		return table->factor[ACCEL_TABLE_SIZE];
+
+	i = (int) x;
+	return table->factor[i] +
+		(x - i) * (table->factor[i + 1] - table->factor[i]);
+}
+
+static double
+calculate_table_acceleration(struct pointer_accelerator *accel,
+			     double velocity)
+{
+	struct accel_table *table = accel->table;
+	double factor;
+
+	/* Same average as calculate_acceleration(), from the table. */
+	factor = accel_table_factor(table, velocity);
+	factor += accel_table_factor(table, accel->last_velocity);
+	factor += 4.0 *
+		accel_table_factor(table,
+				   (accel->last_velocity + velocity) / 2);
+
+	return factor / 6.0;
+}
+
 static double
 soften_delta(double last_delta, double delta)
 {
@@ -283,7 +343,11 @@ accelerator_filter(struct weston_motion_filter *filter,
 
 	feed_trackers(accel, motion->dx, motion->dy, time);
 	velocity = calculate_velocity(accel, time);
-	accel_value = calculate_acceleration(accel, data, velocity, time);
+	if (accel->table)
+		accel_value = calculate_table_acceleration(accel, velocity);
+	else
+		accel_value = calculate_acceleration(accel, data,
+						     velocity, time);
 
 	motion->dx = accel_value * motion->dx;
 	motion->dy = accel_value * motion->dy;
@@ -302,6 +366,7 @@ accelerator_destroy(struct weston_motion_filter *filter)
 	struct pointer_accelerator *accel =
 		(struct pointer_accelerator *) filter;
 
+	free(accel->table);
 	free(accel->trackers);
 	free(accel);
 }
@@ -324,13 +389,46 @@ create_pointer_accelator_filter(accel_profile_func_t profile)
 	wl_list_init(&filter->base.link);
 
 	filter->profile = profile;
+	filter->table = NULL;
 	filter->last_velocity = 0.0;
 	filter->last_dx = 0;
 	filter->last_dy = 0;
 
+	filter->x = 0.0;
+	filter->y = 0.0;
 	filter->trackers =
 		calloc(NUM_POINTER_TRACKERS, sizeof *filter->trackers);
 	filter->cur_tracker = 0;
 
 	return &filter->base;
 }
+
+struct weston_motion_filter *
+create_pointer_accelator_table_filter(accel_profile_func_t profile,
+				      void *data, double max_velocity)
+{
+	struct weston_motion_filter *base;
+	struct pointer_accelerator *filter;
+	struct accel_table *table;
+	int i;
+
+	base = create_pointer_accelator_filter(profile);
+	if (base == NULL)
+		return NULL;
+	filter = (struct pointer_accelerator *) base;
+
+	table = malloc(sizeof *table);
+	if (table == NULL) {
+		accelerator_destroy(base);
+		return NULL;
+	}
+
+	table->scale = ACCEL_TABLE_SIZE / max_velocity;
+	for (i = 0; i <= ACCEL_TABLE_SIZE; i++)
+		table->factor[i] = profile(base, data,
+					   i / table->scale, 0);
+
+	filter->table = table;
+
+	return base;
+}
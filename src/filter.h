@@ -62,4 +62,12 @@ typedef double (*accel_profile_func_t)(struct weston_motion_filter *filter,
 WL_EXPORT struct weston_motion_filter *
 create_pointer_accelator_filter(accel_profile_func_t filter);
 
+/* Like create_pointer_accelator_filter(), for a profile that depends on
+ * velocity only.  The profile is sampled once over [0, max_velocity]
+ * and looked up from a table afterwards; velocities beyond the range
+ * get the factor at max_velocity. */
+WL_EXPORT struct weston_motion_filter *
+create_pointer_accelator_table_filter(accel_profile_func_t profile,
+				      void *data, double max_velocity);
+
 #endif // _FILTER_H_
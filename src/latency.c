@@ -0,0 +1,277 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/input.h>
+
+#include "compositor.h"
+#include "log.h"
+
+/*
+ * Input to present latency tracing.
+ *
+ * Backends that know when the kernel received an input event store
+ * that time, on CLOCK_MONOTONIC, in seat->input_time before notifying
+ * the compositor.  The time then travels as a tag: to the seat when
+ * the event moves the pointer sprite, to the focus surface when the event
+ * is sent to a client and on to the compositor when that client posts
+ * damage.  Each tag keeps the oldest input it stands for.  The output
+ * that repaints next takes the pending tags, and when that frame is
+ * presented the difference to the presentation time is added to the
+ * histogram of its path.  The presentation time is the one the backend
+ * reports in output->presented_time, such as the page flip time, or
+ * else the time the frame is finished.  Hardware cursor moves that
+ * skip the repaint are counted when the new position is handed to the
+ * hardware.
+ */
+
+#define LATENCY_BUCKETS		100	/* 1ms each, the last one is open */
+
+struct latency_histogram {
+	uint32_t count;
+	uint64_t total_us;
+	uint32_t max_us;
+	uint32_t buckets[LATENCY_BUCKETS];
+};
+
+struct latency_tracer {
+	struct weston_compositor *ec;
+	struct latency_histogram histogram[WESTON_LATENCY_PATH_COUNT];
+	struct wl_listener destroy_listener;
+};
+
+static const char *path_names[WESTON_LATENCY_PATH_COUNT] = {
+	[WESTON_LATENCY_SPRITE] = "software cursor",
+	[WESTON_LATENCY_CURSOR] = "hardware cursor",
+	[WESTON_LATENCY_CLIENT] = "client round trip",
+};
+
+static int
+tag_is_set(const struct timespec *tag)
+{
+	return tag->tv_sec != 0 || tag->tv_nsec != 0;
+}
+
+static void
+tag_clear(struct timespec *tag)
+{
+	tag->tv_sec = 0;
+	tag->tv_nsec = 0;
+}
+
+WL_EXPORT void
+weston_latency_tag(struct timespec *tag, const struct timespec *input_time)
+{
+	if (!tag_is_set(input_time))
+		return;
+
+	if (!tag_is_set(tag) ||
+	    input_time->tv_sec < tag->tv_sec ||
+	    (input_time->tv_sec == tag->tv_sec &&
+	     input_time->tv_nsec < tag->tv_nsec))
+		*tag = *input_time;
+}
+
+WL_EXPORT void
+weston_output_latency_repaint(struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_seat *seat;
+	enum weston_latency_path path;
+
+	wl_list_for_each(seat, &ec->seat_list, link) {
+		if (!tag_is_set(&seat->pointer_latency))
+			continue;
+
+		/* assign_planes has run, so the sprite is on the plane
+		 * that shows it in this frame. */
+		if (seat->sprite && seat->sprite->plane != WESTON_PLANE_PRIMARY)
+			path = WESTON_LATENCY_CURSOR;
+		else
+			path = WESTON_LATENCY_SPRITE;
+
+		weston_latency_tag(&output->latency[path],
+				   &seat->pointer_latency);
+		tag_clear(&seat->pointer_latency);
+	}
+
+	weston_latency_tag(&output->latency[WESTON_LATENCY_CLIENT],
+			   &ec->client_latency);
+	tag_clear(&ec->client_latency);
+}
+
+static void
+histogram_add(struct latency_histogram *h, uint32_t us)
+{
+	uint32_t bucket = us / 1000;
+
+	if (bucket >= LATENCY_BUCKETS)
+		bucket = LATENCY_BUCKETS - 1;
+
+	h->count++;
+	h->total_us += us;
+	if (us > h->max_us)
+		h->max_us = us;
+	h->buckets[bucket]++;
+}
+
+static void
+histogram_add_since(struct latency_histogram *h,
+		    const struct timespec *now, const struct timespec *tag)
+{
+	int64_t us;
+
+	us = (now->tv_sec - tag->tv_sec) * 1000000LL +
+		(now->tv_nsec - tag->tv_nsec) / 1000;
+	if (us >= 0)
+		histogram_add(h, us);
+}
+
+WL_EXPORT void
+weston_output_latency_presented(struct weston_output *output)
+{
+	struct latency_tracer *tracer = output->compositor->latency;
+	struct timespec now;
+	int i;
+
+	if (tag_is_set(&output->presented_time))
+		now = output->presented_time;
+	else
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	tag_clear(&output->presented_time);
+
+	if (tracer == NULL)
+		return;
+
+	for (i = 0; i < WESTON_LATENCY_PATH_COUNT; i++) {
+		if (!tag_is_set(&output->latency[i]))
+			continue;
+
+		histogram_add_since(&tracer->histogram[i],
+				    &now, &output->latency[i]);
+		tag_clear(&output->latency[i]);
+	}
+}
+
+WL_EXPORT void
+weston_latency_record(struct weston_compositor *ec,
+		      enum weston_latency_path path,
+		      const struct timespec *input_time)
+{
+	struct latency_tracer *tracer = ec->latency;
+	struct timespec now;
+
+	if (tracer == NULL || !tag_is_set(input_time))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	histogram_add_since(&tracer->histogram[path], &now, input_time);
+}
+
+static uint32_t
+histogram_percentile(struct latency_histogram *h, uint32_t percent)
+{
+	uint64_t target = ((uint64_t) h->count * percent + 99) / 100;
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		sum += h->buckets[i];
+		if (sum >= target)
+			return i + 1;
+	}
+
+	return LATENCY_BUCKETS;
+}
+
+static void
+latency_dump(struct latency_tracer *tracer)
+{
+	struct latency_histogram *h;
+	int i, j;
+
+	for (i = 0; i < WESTON_LATENCY_PATH_COUNT; i++) {
+		h = &tracer->histogram[i];
+		if (h->count == 0) {
+			weston_log("latency: %s: no samples\n", path_names[i]);
+			continue;
+		}
+
+		weston_log("latency: %s: %u samples, mean %.2fms, max %.2fms, "
+			   "p50 <%ums, p90 <%ums, p99 <%ums\n",
+			   path_names[i], h->count,
+			   h->total_us / 1000.0 / h->count, h->max_us / 1000.0,
+			   histogram_percentile(h, 50),
+			   histogram_percentile(h, 90),
+			   histogram_percentile(h, 99));
+
+		for (j = 0; j < LATENCY_BUCKETS; j++)
+			if (h->buckets[j])
+				weston_log_continue("  %2d%sms: %u\n", j,
+						    j == LATENCY_BUCKETS - 1 ?
+						    "+" : "-", h->buckets[j]);
+	}
+}
+
+static void
+latency_binding(struct wl_seat *seat, uint32_t time, uint32_t key,
+		void *data)
+{
+	struct latency_tracer *tracer = data;
+
+	latency_dump(tracer);
+	memset(tracer->histogram, 0, sizeof tracer->histogram);
+}
+
+static void
+latency_destroy(struct wl_listener *listener, void *data)
+{
+	struct latency_tracer *tracer =
+		container_of(listener, struct latency_tracer,
+			     destroy_listener);
+
+	tracer->ec->latency = NULL;
+	free(tracer);
+}
+
+void
+latency_create(struct weston_compositor *ec)
+{
+	struct latency_tracer *tracer;
+
+	tracer = malloc(sizeof *tracer);
+	if (tracer == NULL)
+		return;
+
+	memset(tracer, 0, sizeof *tracer);
+	tracer->ec = ec;
+	ec->latency = tracer;
+
+	weston_compositor_add_key_binding(ec, KEY_L,
+					  MODIFIER_SUPER | MODIFIER_SHIFT,
+					  latency_binding, tracer);
+
+	tracer->destroy_listener.notify = latency_destroy;
+	wl_signal_add(&ec->destroy_signal, &tracer->destroy_listener);
+}
@@ -27,9 +27,13 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/uio.h>
+#include <time.h>
+#include <signal.h>
 
 #include "compositor.h"
+#include "log.h"
 #include "screenshooter-server-protocol.h"
+#include "screencast-server-protocol.h"
 
 #include "../wcap/wcap-decode.h"
 
@@ -40,55 +44,146 @@ struct screenshooter {
 	struct wl_client *client;
 	struct weston_process process;
 	struct wl_listener destroy_listener;
+
+	struct {
+		struct wl_global *global;
+		struct wl_client *client;
+		struct weston_process process;
+		char *path;
+	} screencast;
 };
 
-struct screenshooter_frame_listener {
-	struct wl_listener listener;
+/* A capture waits for the next frame of each output it covers.  If
+ * the client destroys the buffer or the screenshooter before then,
+ * the capture is dropped. */
+struct screenshooter_capture {
 	struct wl_buffer *buffer;
+	struct wl_listener buffer_destroy_listener;
 	struct wl_resource *resource;
+	struct wl_listener resource_destroy_listener;
+	struct wl_list frame_list;
+	int32_t x, y;
+	int pending;
+};
+
+struct screenshooter_frame_listener {
+	struct wl_listener listener;
+	struct screenshooter_capture *capture;
+	struct wl_list link;
+	pixman_box32_t box;
 };
 
 static void
-copy_bgra_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+screenshooter_capture_destroy(struct screenshooter_capture *capture)
 {
-	uint8_t *end;
+	struct screenshooter_frame_listener *l, *next;
 
-	end = dst + height * stride;
-	while (dst < end) {
-		memcpy(dst, src, stride);
-		dst += stride;
-		src -= stride;
+	wl_list_for_each_safe(l, next, &capture->frame_list, link) {
+		wl_list_remove(&l->listener.link);
+		free(l);
 	}
+
+	wl_list_remove(&capture->buffer_destroy_listener.link);
+	wl_list_remove(&capture->resource_destroy_listener.link);
+	free(capture);
 }
 
 static void
-copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
-{
-	uint32_t *dst = vdst;
-	uint32_t *src = vsrc;
-	uint32_t *end = dst + bytes / 4;
-
-	while (dst < end) {
-		uint32_t v = *src++;
-		/*                    A R G B */
-		uint32_t tmp = v & 0xff00ff00;
-		tmp |= (v >> 16) & 0x000000ff;
-		tmp |= (v << 16) & 0x00ff0000;
-		*dst++ = tmp;
-	}
+screenshooter_capture_done(struct screenshooter_capture *capture)
+{
+	capture->pending--;
+	if (capture->pending > 0)
+		return;
+
+	screenshooter_send_done(capture->resource);
+	screenshooter_capture_destroy(capture);
 }
 
 static void
-copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+screenshooter_capture_buffer_destroy(struct wl_listener *listener,
+				     void *data)
 {
-	uint8_t *end;
+	struct screenshooter_capture *capture =
+		container_of(listener, struct screenshooter_capture,
+			     buffer_destroy_listener);
 
-	end = dst + height * stride;
-	while (dst < end) {
-		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
-		src -= stride;
-	}
+	screenshooter_send_done(capture->resource);
+	screenshooter_capture_destroy(capture);
+}
+
+static void
+screenshooter_capture_resource_destroy(struct wl_listener *listener,
+				       void *data)
+{
+	struct screenshooter_capture *capture =
+		container_of(listener, struct screenshooter_capture,
+			     resource_destroy_listener);
+
+	screenshooter_capture_destroy(capture);
+}
+
+static struct screenshooter_capture *
+screenshooter_capture_create(struct wl_resource *resource,
+			     struct wl_buffer *buffer, int32_t x, int32_t y)
+{
+	struct screenshooter_capture *capture;
+
+	capture = malloc(sizeof *capture);
+	if (capture == NULL)
+		return NULL;
+
+	capture->buffer = buffer;
+	capture->buffer_destroy_listener.notify =
+		screenshooter_capture_buffer_destroy;
+	wl_signal_add(&buffer->resource.destroy_signal,
+		      &capture->buffer_destroy_listener);
+	capture->resource = resource;
+	capture->resource_destroy_listener.notify =
+		screenshooter_capture_resource_destroy;
+	wl_signal_add(&resource->destroy_signal,
+		      &capture->resource_destroy_listener);
+	wl_list_init(&capture->frame_list);
+	capture->x = x;
+	capture->y = y;
+	capture->pending = 0;
+
+	return capture;
+}
+
+/* Read box, in global coordinates, back from the framebuffer of output
+ * into dst as top-down xrgb8888 rows of stride bytes. */
+static int
+read_box(struct weston_output *output, pixman_box32_t *box,
+	 uint8_t *dst, int32_t stride)
+{
+	int32_t width, height, x, y, bytes;
+	uint8_t *pixels;
+	int ret;
+
+	width = box->x2 - box->x1;
+	height = box->y2 - box->y1;
+	bytes = width * 4;
+	x = box->x1 - output->x;
+	y = output->current->height - (box->y2 - output->y);
+
+	/* Read straight into the destination when the rows we read are
+	 * exactly its rows.  Otherwise bounce through a staging buffer
+	 * the size of the box. */
+	if (bytes == stride)
+		return weston_compositor_read_pixels(output->compositor,
+						     x, y, width, height,
+						     dst, stride, NULL);
+
+	pixels = malloc(bytes * height);
+	if (pixels == NULL)
+		return -1;
+
+	ret = weston_compositor_read_pixels(output->compositor,
+					    x, y, width, height,
+					    dst, stride, pixels);
+	free(pixels);
+
+	return ret;
 }
 
 static void
@@ -97,44 +192,47 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 	struct screenshooter_frame_listener *l =
 		container_of(listener,
 			     struct screenshooter_frame_listener, listener);
+	struct screenshooter_capture *capture = l->capture;
 	struct weston_output *output = data;
 	int32_t stride;
-	uint8_t *pixels, *d, *s;
+	uint8_t *d;
 
 	wl_list_remove(&listener->link);
-	stride = l->buffer->width * 4;
-	pixels = malloc(stride * l->buffer->height);
+	wl_list_remove(&l->link);
 
-	if (pixels == NULL) {
-		wl_resource_post_no_memory(l->resource);
-		free(l);
-		return;
-	}
+	stride = wl_shm_buffer_get_stride(capture->buffer);
+	d = wl_shm_buffer_get_data(capture->buffer);
+	d += (l->box.y1 - capture->y) * stride +
+		(l->box.x1 - capture->x) * 4;
+
+	if (read_box(output, &l->box, d, stride) < 0)
+		wl_resource_post_no_memory(capture->resource);
+
+	screenshooter_capture_done(capture);
+	free(l);
+}
 
-	glPixelStorei(GL_PACK_ALIGNMENT, 1);
-	glReadPixels(0, 0, output->current->width, output->current->height,
-		     output->compositor->read_format,
-		     GL_UNSIGNED_BYTE, pixels);
+static int
+screenshooter_capture_output(struct screenshooter_capture *capture,
+			     struct weston_output *output,
+			     pixman_box32_t *box)
+{
+	struct screenshooter_frame_listener *l;
 
-	stride = wl_shm_buffer_get_stride(l->buffer);
+	l = malloc(sizeof *l);
+	if (l == NULL)
+		return -1;
 
-	d = wl_shm_buffer_get_data(l->buffer);
-	s = pixels + stride * (l->buffer->height - 1);
+	l->capture = capture;
+	l->box = *box;
+	wl_list_insert(&capture->frame_list, &l->link);
+	capture->pending++;
 
-	switch (output->compositor->read_format) {
-	case GL_BGRA_EXT:
-		copy_bgra_yflip(d, s, output->current->height, stride);
-		break;
-	case GL_RGBA:
-		copy_rgba_yflip(d, s, output->current->height, stride);
-		break;
-	default:
-		break;
-	}
+	l->listener.notify = screenshooter_frame_notify;
+	wl_signal_add(&output->frame_signal, &l->listener);
+	weston_output_schedule_repaint(output);
 
-	screenshooter_send_done(l->resource);
-	free(pixels);
-	free(l);
+	return 0;
 }
 
 static void
@@ -144,7 +242,7 @@ screenshooter_shoot(struct wl_client *client,
 		    struct wl_resource *buffer_resource)
 {
 	struct weston_output *output = output_resource->data;
-	struct screenshooter_frame_listener *l;
+	struct screenshooter_capture *capture;
 	struct wl_buffer *buffer = buffer_resource->data;
 
 	if (!wl_buffer_is_shm(buffer))
@@ -154,22 +252,67 @@ screenshooter_shoot(struct wl_client *client,
 	    buffer->height < output->current->height)
 		return;
 
-	l = malloc(sizeof *l);
-	if (l == NULL) {
+	capture = screenshooter_capture_create(resource, buffer,
+					       output->x, output->y);
+	if (capture == NULL) {
 		wl_resource_post_no_memory(resource);
 		return;
 	}
 
-	l->buffer = buffer;
-	l->resource = resource;
+	if (screenshooter_capture_output(capture, output,
+					 pixman_region32_extents(&output->region)) < 0) {
+		screenshooter_capture_destroy(capture);
+		wl_resource_post_no_memory(resource);
+	}
+}
 
-	l->listener.notify = screenshooter_frame_notify;
-	wl_signal_add(&output->frame_signal, &l->listener);
-	weston_output_schedule_repaint(output);
+static void
+screenshooter_shoot_region(struct wl_client *client,
+			   struct wl_resource *resource,
+			   struct wl_resource *buffer_resource,
+			   int32_t x, int32_t y,
+			   int32_t width, int32_t height)
+{
+	struct screenshooter *shooter = resource->data;
+	struct screenshooter_capture *capture;
+	struct wl_buffer *buffer = buffer_resource->data;
+	struct weston_output *output;
+	pixman_region32_t region;
+	pixman_box32_t *box;
+
+	if (!wl_buffer_is_shm(buffer))
+		return;
+
+	if (width <= 0 || height <= 0 ||
+	    buffer->width < width || buffer->height < height)
+		return;
+
+	capture = screenshooter_capture_create(resource, buffer, x, y);
+	if (capture == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	/* Hold a reference while we queue up the outputs, so that we
+	 * send done exactly once, even if nothing intersects. */
+	capture->pending = 1;
+
+	wl_list_for_each(output, &shooter->ec->output_list, link) {
+		pixman_region32_init_rect(&region, x, y, width, height);
+		pixman_region32_intersect(&region, &region, &output->region);
+		box = pixman_region32_extents(&region);
+		if (pixman_region32_not_empty(&region) &&
+		    screenshooter_capture_output(capture, output, box) < 0)
+			wl_resource_post_no_memory(resource);
+		pixman_region32_fini(&region);
+	}
+
+	screenshooter_capture_done(capture);
 }
 
 struct screenshooter_interface screenshooter_implementation = {
-	screenshooter_shoot
+	screenshooter_shoot,
+	screenshooter_shoot_region
 };
 
 static void
@@ -217,6 +360,18 @@ struct weston_recorder {
 	int fd;
 	struct wl_listener frame_listener;
 	int count;
+	int width;
+	struct weston_compositor *compositor;
+
+	/* With pixel pack buffers, the damage of a frame is read into
+	 * pbo[current] while it is being composited and only encoded
+	 * when the next frame comes in, so that we never wait for the
+	 * GPU.  pending is set when pbo[!current] holds such a frame. */
+	GLuint pbo[2];
+	int current;
+	int pending;
+	uint32_t pending_msecs;
+	pixman_region32_t pending_damage;
 };
 
 static uint32_t *
@@ -250,82 +405,165 @@ component_delta(uint32_t next, uint32_t prev)
 	return (dr << 16) | (dg << 8) | (db << 0);
 }
 
+static void
+weston_recorder_write_header(struct weston_recorder *recorder,
+			     uint32_t msecs, pixman_box32_t *r, int n)
+{
+	struct {
+		uint32_t msecs;
+		uint32_t nrects;
+	} header;
+	struct iovec v[2];
+
+	header.msecs = msecs;
+	header.nrects = n;
+	v[0].iov_base = &header;
+	v[0].iov_len = sizeof header;
+	v[1].iov_base = r;
+	v[1].iov_len = n * sizeof *r;
+	recorder->total += writev(recorder->fd, v, 2);
+}
+
+/* Encode the bottom-up pixels s read back for the rectangle r. */
+static void
+weston_recorder_encode_rect(struct weston_recorder *recorder,
+			    pixman_box32_t *r, uint32_t *s)
+{
+	int j, k, width, height, run, stride;
+	uint32_t delta, prev, *d, *p, next;
+
+	width = r->x2 - r->x1;
+	height = r->y2 - r->y1;
+	stride = recorder->width;
+
+	p = recorder->rect;
+	run = prev = 0; /* quiet gcc */
+	for (j = 0; j < height; j++) {
+		d = recorder->frame + stride * (r->y2 - j - 1) + r->x1;
+		for (k = 0; k < width; k++) {
+			next = *s++;
+			delta = component_delta(next, *d);
+			*d++ = next;
+			if (run == 0 || delta == prev) {
+				run++;
+			} else {
+				p = output_run(p, prev, run);
+				run = 1;
+			}
+			prev = delta;
+		}
+	}
+
+	p = output_run(p, prev, run);
+
+	recorder->total += write(recorder->fd,
+				 recorder->rect, (p - recorder->rect) * 4);
+
+#if 0
+	fprintf(stderr,
+		"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
+		width, height, r->x1, r->y1,
+		width * height * 4, (int) (p - recorder->rect) * 4,
+		(float) (p - recorder->rect) / (width * height),
+		recorder->total / 1024 / 1024);
+#endif
+}
+
+/* Encode the frame waiting in pbo[!current], if any. */
+static void
+weston_recorder_flush_pending(struct weston_recorder *recorder,
+			      struct weston_compositor *ec)
+{
+	pixman_box32_t *r;
+	uint8_t *map;
+	int i, n, size;
+
+	if (!recorder->pending)
+		return;
+
+	recorder->pending = 0;
+	r = pixman_region32_rectangles(&recorder->pending_damage, &n);
+	size = 0;
+	for (i = 0; i < n; i++)
+		size += (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1) * 4;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, recorder->pbo[!recorder->current]);
+	map = ec->map_buffer_range(GL_PIXEL_PACK_BUFFER_NV, 0, size,
+				   GL_MAP_READ_BIT_EXT);
+	if (map == NULL) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+		return;
+	}
+
+	weston_recorder_write_header(recorder, recorder->pending_msecs, r, n);
+	for (i = 0; i < n; i++) {
+		weston_recorder_encode_rect(recorder, &r[i], (uint32_t *) map);
+		map += (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1) * 4;
+	}
+
+	ec->unmap_buffer(GL_PIXEL_PACK_BUFFER_NV);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+}
+
 static void
 weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 {
 	struct weston_recorder *recorder =
 		container_of(listener, struct weston_recorder, frame_listener);
 	struct weston_output *output = data;
+	struct weston_compositor *ec = output->compositor;
 	uint32_t msecs = output->frame_time;
 	pixman_box32_t *r;
 	pixman_region32_t damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
-	struct iovec v[2];
+	int i, n, width, height;
+	GLintptr offset;
 
 	pixman_region32_init(&damage);
 	pixman_region32_intersect(&damage, &output->region,
 				  &output->previous_damage);
 
 	r = pixman_region32_rectangles(&damage, &n);
-	if (n == 0)
+	if (n == 0) {
+		pixman_region32_fini(&damage);
 		return;
+	}
 
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current->width;
+	if (ec->has_pbo) {
+		/* Queue up the reads for this frame, then encode the
+		 * previous one, which the GPU has long finished. */
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV,
+			     recorder->pbo[recorder->current]);
+		offset = 0;
+		for (i = 0; i < n; i++) {
+			width = r[i].x2 - r[i].x1;
+			height = r[i].y2 - r[i].y1;
+			glReadPixels(r[i].x1, output->current->height - r[i].y2,
+				     width, height, ec->read_format,
+				     GL_UNSIGNED_BYTE, (void *) offset);
+			offset += width * height * 4;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+
+		weston_recorder_flush_pending(recorder, ec);
+
+		recorder->pending = 1;
+		recorder->pending_msecs = msecs;
+		pixman_region32_copy(&recorder->pending_damage, &damage);
+		recorder->current = !recorder->current;
+		pixman_region32_fini(&damage);
+		return;
+	}
+
+	weston_recorder_write_header(recorder, msecs, r, n);
 
 	for (i = 0; i < n; i++) {
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
 		glReadPixels(r[i].x1, output->current->height - r[i].y2,
-			     width, height,
-			     output->compositor->read_format,
+			     width, height, ec->read_format,
 			     GL_UNSIGNED_BYTE, recorder->rect);
 
-		s = recorder->rect;
-		p = recorder->rect;
-		run = prev = 0; /* quiet gcc */
-		for (j = 0; j < height; j++) {
-			d = recorder->frame +
-				stride * (r[i].y2 - j - 1) + r[i].x1;
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
-		}
-
-		p = output_run(p, prev, run);
-
-		recorder->total += write(recorder->fd,
-					 recorder->rect,
-					 (p - recorder->rect) * 4);
-
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - recorder->rect) * 4,
-			(float) (p - recorder->rect) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
+		weston_recorder_encode_rect(recorder, &r[i], recorder->rect);
 	}
 
 	pixman_region32_fini(&damage);
@@ -346,8 +584,27 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	recorder->rect = malloc(size);
 	recorder->total = 0;
 	recorder->count = 0;
+	recorder->width = stride;
+	recorder->compositor = output->compositor;
 	memset(recorder->frame, 0, size);
 
+	recorder->current = 0;
+	recorder->pending = 0;
+	pixman_region32_init(&recorder->pending_damage);
+	if (output->compositor->has_pbo) {
+		/* Each frame's damage rectangles are packed back to back
+		 * and never overlap, so one output's worth is enough.
+		 * GLES2 only knows the DRAW usage hints. */
+		glGenBuffers(2, recorder->pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, recorder->pbo[0]);
+		glBufferData(GL_PIXEL_PACK_BUFFER_NV, size, NULL,
+			     GL_STREAM_DRAW);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, recorder->pbo[1]);
+		glBufferData(GL_PIXEL_PACK_BUFFER_NV, size, NULL,
+			     GL_STREAM_DRAW);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+	}
+
 	recorder->fd = open(filename,
 			    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
 
@@ -375,6 +632,11 @@ static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
 	wl_list_remove(&recorder->frame_listener.link);
+	if (recorder->compositor->has_pbo) {
+		weston_recorder_flush_pending(recorder, recorder->compositor);
+		glDeleteBuffers(2, recorder->pbo);
+	}
+	pixman_region32_fini(&recorder->pending_damage);
 	close(recorder->fd);
 	free(recorder->frame);
 	free(recorder->rect);
@@ -410,6 +672,283 @@ recorder_binding(struct wl_seat *seat, uint32_t time, uint32_t key, void *data)
 	}
 }
 
+struct screencast_buffer {
+	struct wl_buffer *buffer;
+	struct wl_listener buffer_destroy_listener;
+	struct wl_list link;
+};
+
+struct screencast_session {
+	struct wl_resource resource;
+	struct weston_output *output;
+	struct wl_listener frame_listener;
+	struct wl_listener output_destroy_listener;
+	struct wl_list buffer_list;
+	pixman_region32_t damage;
+};
+
+static void
+screencast_buffer_destroy(struct screencast_buffer *sb)
+{
+	wl_list_remove(&sb->buffer_destroy_listener.link);
+	wl_list_remove(&sb->link);
+	free(sb);
+}
+
+static void
+screencast_handle_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct screencast_buffer *sb =
+		container_of(listener, struct screencast_buffer,
+			     buffer_destroy_listener);
+
+	screencast_buffer_destroy(sb);
+}
+
+static void
+screencast_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct screencast_session *session =
+		container_of(listener, struct screencast_session,
+			     frame_listener);
+	struct weston_output *output = data;
+	struct screencast_buffer *sb;
+	struct wl_buffer *buffer;
+	struct timespec ts;
+	struct wl_array damage;
+	pixman_box32_t *r;
+	int32_t stride, *p;
+	uint8_t *d;
+	int i, n;
+
+	/* output->previous_damage is what this repaint changed. */
+	pixman_region32_union(&session->damage, &session->damage,
+			      &output->previous_damage);
+	pixman_region32_intersect(&session->damage, &session->damage,
+				  &output->region);
+
+	if (wl_list_empty(&session->buffer_list) ||
+	    !pixman_region32_not_empty(&session->damage))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	sb = container_of(session->buffer_list.next,
+			  struct screencast_buffer, link);
+	buffer = sb->buffer;
+	screencast_buffer_destroy(sb);
+
+	stride = wl_shm_buffer_get_stride(buffer);
+	r = pixman_region32_rectangles(&session->damage, &n);
+
+	wl_array_init(&damage);
+	for (i = 0; i < n; i++) {
+		d = wl_shm_buffer_get_data(buffer);
+		d += (r[i].y1 - output->y) * stride + (r[i].x1 - output->x) * 4;
+		if (read_box(output, &r[i], d, stride) < 0) {
+			wl_resource_post_no_memory(&session->resource);
+			break;
+		}
+
+		p = wl_array_add(&damage, 4 * sizeof *p);
+		if (p == NULL) {
+			wl_resource_post_no_memory(&session->resource);
+			break;
+		}
+		p[0] = r[i].x1 - output->x;
+		p[1] = r[i].y1 - output->y;
+		p[2] = r[i].x2 - r[i].x1;
+		p[3] = r[i].y2 - r[i].y1;
+	}
+
+	screencast_session_send_frame(&session->resource, &buffer->resource,
+				      ts.tv_sec, ts.tv_nsec, &damage);
+	wl_array_release(&damage);
+
+	pixman_region32_clear(&session->damage);
+}
+
+static void
+screencast_session_destroy(struct wl_client *client,
+			   struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+screencast_session_queue_buffer(struct wl_client *client,
+				struct wl_resource *resource,
+				struct wl_resource *buffer_resource)
+{
+	struct screencast_session *session = resource->data;
+	struct weston_output *output = session->output;
+	struct wl_buffer *buffer = buffer_resource->data;
+	struct screencast_buffer *sb;
+
+	/* The output is gone and the client has been sent done; the
+	 * buffer would never be filled. */
+	if (output == NULL)
+		return;
+
+	if (!wl_buffer_is_shm(buffer) ||
+	    buffer->width < output->current->width ||
+	    buffer->height < output->current->height) {
+		wl_resource_post_error(resource,
+				       SCREENCAST_SESSION_ERROR_INVALID_BUFFER,
+				       "buffer must be shm and cover the output");
+		return;
+	}
+
+	sb = malloc(sizeof *sb);
+	if (sb == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	sb->buffer = buffer;
+	sb->buffer_destroy_listener.notify = screencast_handle_buffer_destroy;
+	wl_signal_add(&buffer->resource.destroy_signal,
+		      &sb->buffer_destroy_listener);
+	wl_list_insert(session->buffer_list.prev, &sb->link);
+
+	/* Damage carried over from frames we had no buffer for only
+	 * reaches the client on the next repaint. */
+	if (pixman_region32_not_empty(&session->damage))
+		weston_output_schedule_repaint(output);
+}
+
+static const struct screencast_session_interface screencast_session_implementation = {
+	screencast_session_destroy,
+	screencast_session_queue_buffer
+};
+
+static void
+screencast_session_stop(struct screencast_session *session)
+{
+	struct screencast_buffer *sb, *next;
+
+	wl_list_for_each_safe(sb, next, &session->buffer_list, link)
+		screencast_buffer_destroy(sb);
+
+	if (session->output) {
+		wl_list_remove(&session->frame_listener.link);
+		wl_list_remove(&session->output_destroy_listener.link);
+		session->output = NULL;
+	}
+}
+
+static void
+screencast_output_destroy_notify(struct wl_listener *listener, void *data)
+{
+	struct screencast_session *session =
+		container_of(listener, struct screencast_session,
+			     output_destroy_listener);
+
+	screencast_session_stop(session);
+	screencast_session_send_done(&session->resource);
+}
+
+static void
+destroy_screencast_session(struct wl_resource *resource)
+{
+	struct screencast_session *session =
+		container_of(resource, struct screencast_session, resource);
+
+	screencast_session_stop(session);
+	pixman_region32_fini(&session->damage);
+	free(session);
+}
+
+static void
+screencast_start(struct wl_client *client, struct wl_resource *resource,
+		 uint32_t id, struct wl_resource *output_resource)
+{
+	struct weston_output *output = output_resource->data;
+	struct screencast_session *session;
+
+	session = malloc(sizeof *session);
+	if (session == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	session->resource.destroy = destroy_screencast_session;
+	session->resource.object.id = id;
+	session->resource.object.interface = &screencast_session_interface;
+	session->resource.object.implementation =
+		(void (**)(void)) &screencast_session_implementation;
+	session->resource.data = session;
+
+	session->output = output;
+	wl_list_init(&session->buffer_list);
+
+	/* The client has nothing yet, so the first frame is all damage. */
+	pixman_region32_init(&session->damage);
+	pixman_region32_copy(&session->damage, &output->region);
+
+	session->frame_listener.notify = screencast_frame_notify;
+	wl_signal_add(&output->frame_signal, &session->frame_listener);
+	session->output_destroy_listener.notify =
+		screencast_output_destroy_notify;
+	wl_signal_add(&output->destroy_signal,
+		      &session->output_destroy_listener);
+
+	wl_client_add_resource(client, &session->resource);
+}
+
+static const struct screencast_interface screencast_implementation = {
+	screencast_start
+};
+
+static void
+bind_screencast(struct wl_client *client,
+		void *data, uint32_t version, uint32_t id)
+{
+	struct screenshooter *shooter = data;
+	struct wl_resource *resource;
+
+	resource = wl_client_add_object(client, &screencast_interface,
+					&screencast_implementation, id, data);
+
+	if (client != shooter->screencast.client) {
+		wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_OBJECT,
+				       "screencast failed: permission denied");
+		wl_resource_destroy(resource);
+	}
+}
+
+static void
+screencast_sigchld(struct weston_process *process, int status)
+{
+	struct screenshooter *shooter =
+		container_of(process, struct screenshooter, screencast.process);
+
+	shooter->screencast.client = NULL;
+}
+
+static void
+screencast_binding(struct wl_seat *seat, uint32_t time, uint32_t key,
+		   void *data)
+{
+	struct screenshooter *shooter = data;
+
+	if (!shooter->screencast.path) {
+		weston_log("no screencast client configured\n");
+		return;
+	}
+
+	if (shooter->screencast.client) {
+		kill(shooter->screencast.process.pid, SIGTERM);
+		return;
+	}
+
+	shooter->screencast.client =
+		weston_client_launch(shooter->ec,
+				     &shooter->screencast.process,
+				     shooter->screencast.path,
+				     screencast_sigchld);
+}
+
 static void
 screenshooter_destroy(struct wl_listener *listener, void *data)
 {
@@ -417,6 +956,9 @@ screenshooter_destroy(struct wl_listener *listener, void *data)
 		container_of(listener, struct screenshooter, destroy_listener);
 
 	wl_display_remove_global(shooter->ec->wl_display, shooter->global);
+	wl_display_remove_global(shooter->ec->wl_display,
+				 shooter->screencast.global);
+	free(shooter->screencast.path);
 	free(shooter);
 }
 
@@ -424,11 +966,26 @@ void
 screenshooter_create(struct weston_compositor *ec)
 {
 	struct screenshooter *shooter;
+	char *config_file;
+	char *path = NULL;
+
+	struct config_key screencast_keys[] = {
+		{ "path",	CONFIG_KEY_STRING, &path },
+	};
+
+	struct config_section cs[] = {
+		{ "screencast",
+		  screencast_keys, ARRAY_LENGTH(screencast_keys), NULL },
+	};
 
 	shooter = malloc(sizeof *shooter);
 	if (shooter == NULL)
 		return;
 
+	config_file = config_file_path("weston.ini");
+	parse_config_file(config_file, cs, ARRAY_LENGTH(cs), shooter);
+	free(config_file);
+
 	shooter->base.interface = &screenshooter_interface;
 	shooter->base.implementation =
 		(void(**)(void)) &screenshooter_implementation;
@@ -443,6 +1000,15 @@ screenshooter_create(struct weston_compositor *ec)
 	weston_compositor_add_key_binding(ec, KEY_R, MODIFIER_SUPER,
 					  recorder_binding, shooter);
 
+	shooter->screencast.path = path;
+	shooter->screencast.client = NULL;
+	shooter->screencast.global =
+		wl_display_add_global(ec->wl_display, &screencast_interface,
+				      shooter, bind_screencast);
+	weston_compositor_add_key_binding(ec, KEY_R,
+					  MODIFIER_SUPER | MODIFIER_SHIFT,
+					  screencast_binding, shooter);
+
 	shooter->destroy_listener.notify = screenshooter_destroy;
 	wl_signal_add(&ec->destroy_signal, &shooter->destroy_listener);
 }
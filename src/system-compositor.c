@@ -139,14 +139,22 @@ key_binding_handler (struct wl_seat *seat, uint32_t time,
 	wl_display_manager_send_keybinding_notify(khd->resource, khd->cookie);
 }
 
-static int
-is_same_keybinding(struct weston_binding *binding,
-		   uint32_t key, uint32_t modifier, uint32_t cookie)
+static struct weston_binding *
+find_keybinding(struct weston_compositor *compositor,
+		uint32_t key, uint32_t modifier, uint32_t cookie)
 {
-	struct key_handler_data *data = binding->data;
-	return ((binding->key == key) &&
-		(binding->modifier == modifier) &&
-		(data->cookie == cookie));
+	struct weston_binding *binding = NULL;
+	struct key_handler_data *data;
+
+	while ((binding = weston_binding_table_next(&compositor->key_bindings,
+						    binding, key, modifier))) {
+		data = binding->data;
+		if (binding->handler == key_binding_handler &&
+		    data->cookie == cookie)
+			return binding;
+	}
+
+	return NULL;
 }
 
 static void
@@ -156,16 +164,13 @@ bind_key (struct wl_client *client,
 {
 	struct display_manager *dm = resource->data;
 	struct weston_compositor *compositor = dm->sc->compositor;
-	struct weston_binding *binding;
 	struct key_handler_data *khd;
 
-	wl_list_for_each(binding, &compositor->key_binding_list, link) {
-		if (is_same_keybinding(binding, key, modifier, cookie)) {
-			wl_resource_post_error(resource, WL_DISPLAY_MANAGER_ERROR_KEYBINDING_EXISTS,
-					       "attempt to register duplicate keybinding");
-			return;
-		}
-	}		
+	if (find_keybinding(compositor, key, modifier, cookie)) {
+		wl_resource_post_error(resource, WL_DISPLAY_MANAGER_ERROR_KEYBINDING_EXISTS,
+				       "attempt to register duplicate keybinding");
+		return;
+	}
 
 	khd = malloc(sizeof *khd);
 	if (!khd) {
@@ -188,14 +193,13 @@ unbind_key (struct wl_client *client,
 {
 	struct display_manager *dm = resource->data;
 	struct weston_compositor *compositor = dm->sc->compositor;
-	struct weston_binding *binding, *tmp;
+	struct weston_binding *binding;
 
-	wl_list_for_each_safe(binding, tmp, &compositor->key_binding_list, link) {
-		if (is_same_keybinding(binding, key, modifier, cookie)) {
-			free(binding->data);
-			weston_binding_destroy(binding);
-			return;
-		}
+	binding = find_keybinding(compositor, key, modifier, cookie);
+	if (binding) {
+		free(binding->data);
+		weston_binding_destroy(binding);
+		return;
 	}
 
 	wl_resource_post_error(resource, WL_DISPLAY_MANAGER_ERROR_INVALID_KEYBINDING,
@@ -399,7 +403,7 @@ shell_init(struct weston_compositor *ec, int *argc, char *argv[])
 		return -1;
 
 	/* We want to claim all the keybindings */
-	weston_binding_list_destroy_all(&ec->key_binding_list);
+	weston_binding_table_destroy_all(&ec->key_bindings);
 
 	/* Turning off the display is a bit user hostile :) */
 	weston_compositor_idle_inihibit(ec);
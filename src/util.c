@@ -260,10 +260,56 @@ weston_slide_run(struct weston_surface *surface, GLfloat start, GLfloat stop,
 	return animation;
 }
 
+static struct wl_list *
+binding_bucket(struct weston_binding_table *table,
+	       uint32_t code, uint32_t modifier)
+{
+	uint32_t hash = (code * 31 + modifier) * 2654435761u;
+
+	return &table->buckets[(hash >> 16) & (WESTON_BINDING_BUCKETS - 1)];
+}
+
+static uint32_t
+binding_code(struct weston_binding *binding)
+{
+	/* Only one of them is set, see the add functions below. */
+	return binding->key | binding->button | binding->axis;
+}
+
+WL_EXPORT void
+weston_binding_table_init(struct weston_binding_table *table)
+{
+	int i;
+
+	for (i = 0; i < WESTON_BINDING_BUCKETS; i++)
+		wl_list_init(&table->buckets[i]);
+}
+
+/* Returns the binding for code and modifier that was added after prev,
+ * or the first one if prev is NULL. */
+WL_EXPORT struct weston_binding *
+weston_binding_table_next(struct weston_binding_table *table,
+			  struct weston_binding *prev,
+			  uint32_t code, uint32_t modifier)
+{
+	struct wl_list *bucket = binding_bucket(table, code, modifier);
+	struct wl_list *link = prev ? prev->link.next : bucket->next;
+	struct weston_binding *binding;
+
+	for (; link != bucket; link = link->next) {
+		binding = container_of(link, struct weston_binding, link);
+		if (binding_code(binding) == code &&
+		    binding->modifier == modifier)
+			return binding;
+	}
+
+	return NULL;
+}
+
 static struct weston_binding *
-weston_compositor_add_binding(struct weston_compositor *compositor,
-			      uint32_t key, uint32_t button, uint32_t axis,
-			      uint32_t modifier, void *handler, void *data)
+binding_table_add(struct weston_binding_table *table,
+		  uint32_t key, uint32_t button, uint32_t axis,
+		  uint32_t modifier, void *handler, void *data)
 {
 	struct weston_binding *binding;
 
@@ -278,6 +324,10 @@ weston_compositor_add_binding(struct weston_compositor *compositor,
 	binding->handler = handler;
 	binding->data = data;
 
+	wl_list_insert(binding_bucket(table, key | button | axis,
+				      modifier)->prev,
+		       &binding->link);
+
 	return binding;
 }
 
@@ -287,16 +337,8 @@ weston_compositor_add_key_binding(struct weston_compositor *compositor,
 				  weston_key_binding_handler_t handler,
 				  void *data)
 {
-	struct weston_binding *binding;
-
-	binding = weston_compositor_add_binding(compositor, key, 0, 0,
-						modifier, handler, data);
-	if (binding == NULL)
-		return NULL;
-
-	wl_list_insert(compositor->key_binding_list.prev, &binding->link);
-
-	return binding;
+	return binding_table_add(&compositor->key_bindings, key, 0, 0,
+				 modifier, handler, data);
 }
 
 WL_EXPORT struct weston_binding *
@@ -305,16 +347,8 @@ weston_compositor_add_button_binding(struct weston_compositor *compositor,
 				     weston_button_binding_handler_t handler,
 				     void *data)
 {
-	struct weston_binding *binding;
-
-	binding = weston_compositor_add_binding(compositor, 0, button, 0,
-						modifier, handler, data);
-	if (binding == NULL)
-		return NULL;
-
-	wl_list_insert(compositor->button_binding_list.prev, &binding->link);
-
-	return binding;
+	return binding_table_add(&compositor->button_bindings, 0, button, 0,
+				 modifier, handler, data);
 }
 
 WL_EXPORT struct weston_binding *
@@ -323,16 +357,8 @@ weston_compositor_add_axis_binding(struct weston_compositor *compositor,
 				   weston_axis_binding_handler_t handler,
 				   void *data)
 {
-	struct weston_binding *binding;
-
-	binding = weston_compositor_add_binding(compositor, 0, 0, axis,
-						modifier, handler, data);
-	if (binding == NULL)
-		return NULL;
-
-	wl_list_insert(compositor->axis_binding_list.prev, &binding->link);
-
-	return binding;
+	return binding_table_add(&compositor->axis_bindings, 0, 0, axis,
+				 modifier, handler, data);
 }
 
 WL_EXPORT void
@@ -343,12 +369,14 @@ weston_binding_destroy(struct weston_binding *binding)
 }
 
 WL_EXPORT void
-weston_binding_list_destroy_all(struct wl_list *list)
+weston_binding_table_destroy_all(struct weston_binding_table *table)
 {
 	struct weston_binding *binding, *tmp;
+	int i;
 
-	wl_list_for_each_safe(binding, tmp, list, link)
-		weston_binding_destroy(binding);
+	for (i = 0; i < WESTON_BINDING_BUCKETS; i++)
+		wl_list_for_each_safe(binding, tmp, &table->buckets[i], link)
+			weston_binding_destroy(binding);
 }
 
 struct binding_keyboard_grab {
@@ -418,23 +446,26 @@ weston_compositor_run_key_binding(struct weston_compositor *compositor,
 				  uint32_t time, uint32_t key,
 				  enum wl_keyboard_key_state state)
 {
-	struct weston_binding *b;
+	struct weston_binding_table *table = &compositor->key_bindings;
+	uint32_t modifier = seat->modifier_state;
+	struct weston_binding *b, *next;
+	weston_key_binding_handler_t handler;
 
 	if (state == WL_KEYBOARD_KEY_STATE_RELEASED)
 		return;
 
-	wl_list_for_each(b, &compositor->key_binding_list, link) {
-		if (b->key == key && b->modifier == seat->modifier_state) {
-			weston_key_binding_handler_t handler = b->handler;
-			handler(&seat->seat, time, key, b->data);
-
-			/* If this was a key binding and it didn't
-			 * install a keyboard grab, install one now to
-			 * swallow the key release. */
-			if (seat->seat.keyboard->grab ==
-			    &seat->seat.keyboard->default_grab)
-				install_binding_grab(&seat->seat, time, key);
-		}
+	b = weston_binding_table_next(table, NULL, key, modifier);
+	for (; b; b = next) {
+		next = weston_binding_table_next(table, b, key, modifier);
+		handler = b->handler;
+		handler(&seat->seat, time, key, b->data);
+
+		/* If this was a key binding and it didn't
+		 * install a keyboard grab, install one now to
+		 * swallow the key release. */
+		if (seat->seat.keyboard->grab ==
+		    &seat->seat.keyboard->default_grab)
+			install_binding_grab(&seat->seat, time, key);
 	}
 }
 
@@ -444,16 +475,19 @@ weston_compositor_run_button_binding(struct weston_compositor *compositor,
 				     uint32_t time, uint32_t button,
 				     enum wl_pointer_button_state state)
 {
-	struct weston_binding *b;
+	struct weston_binding_table *table = &compositor->button_bindings;
+	uint32_t modifier = seat->modifier_state;
+	struct weston_binding *b, *next;
+	weston_button_binding_handler_t handler;
 
 	if (state == WL_POINTER_BUTTON_STATE_RELEASED)
 		return;
 
-	wl_list_for_each(b, &compositor->button_binding_list, link) {
-		if (b->button == button && b->modifier == seat->modifier_state) {
-			weston_button_binding_handler_t handler = b->handler;
-			handler(&seat->seat, time, button, b->data);
-		}
+	b = weston_binding_table_next(table, NULL, button, modifier);
+	for (; b; b = next) {
+		next = weston_binding_table_next(table, b, button, modifier);
+		handler = b->handler;
+		handler(&seat->seat, time, button, b->data);
 	}
 }
 
@@ -463,13 +497,16 @@ weston_compositor_run_axis_binding(struct weston_compositor *compositor,
 				   uint32_t time, uint32_t axis,
 				   wl_fixed_t value)
 {
-	struct weston_binding *b;
-
-	wl_list_for_each(b, &compositor->axis_binding_list, link) {
-		if (b->axis == axis && b->modifier == seat->modifier_state) {
-			weston_axis_binding_handler_t handler = b->handler;
-			handler(&seat->seat, time, axis, value, b->data);
-		}
+	struct weston_binding_table *table = &compositor->axis_bindings;
+	uint32_t modifier = seat->modifier_state;
+	struct weston_binding *b, *next;
+	weston_axis_binding_handler_t handler;
+
+	b = weston_binding_table_next(table, NULL, axis, modifier);
+	for (; b; b = next) {
+		next = weston_binding_table_next(table, b, axis, modifier);
+		handler = b->handler;
+		handler(&seat->seat, time, axis, value, b->data);
 	}
 }
 
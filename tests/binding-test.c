@@ -0,0 +1,196 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+#include <linux/input.h>
+
+#include "../src/compositor.h"
+#include "test-runner.h"
+
+/* A modifier combination nothing else binds, so only our bindings
+ * match. */
+#define TEST_MODIFIER	(MODIFIER_CTRL | MODIFIER_ALT | MODIFIER_SUPER)
+
+static int order[8];
+static int count;
+
+static void
+key_handler(struct wl_seat *seat, uint32_t time, uint32_t key, void *data)
+{
+	order[count++] = (intptr_t) data;
+}
+
+static void
+button_handler(struct wl_seat *seat, uint32_t time, uint32_t button,
+	       void *data)
+{
+	order[count++] = (intptr_t) data;
+}
+
+static void
+axis_handler(struct wl_seat *seat, uint32_t time, uint32_t axis,
+	     wl_fixed_t value, void *data)
+{
+	order[count++] = (intptr_t) data;
+}
+
+/* Call the handlers of the key bindings for key the way
+ * weston_compositor_run_key_binding() walks them, without the
+ * keyboard grab it installs. */
+static void
+run_key_bindings(struct weston_compositor *compositor, uint32_t key)
+{
+	struct weston_binding_table *table = &compositor->key_bindings;
+	struct weston_binding *b;
+	weston_key_binding_handler_t handler;
+
+	count = 0;
+	b = weston_binding_table_next(table, NULL, key, TEST_MODIFIER);
+	for (; b; b = weston_binding_table_next(table, b, key,
+						TEST_MODIFIER)) {
+		handler = b->handler;
+		handler(NULL, 0, key, b->data);
+	}
+}
+
+static void
+run_button_bindings(struct weston_compositor *compositor, uint32_t button)
+{
+	struct weston_seat *seat = compositor->seat;
+	enum weston_keyboard_modifier modifier = seat->modifier_state;
+
+	count = 0;
+	seat->modifier_state = TEST_MODIFIER;
+	weston_compositor_run_button_binding(compositor, seat, 0, button,
+					     WL_POINTER_BUTTON_STATE_PRESSED);
+	seat->modifier_state = modifier;
+}
+
+static void
+run_axis_bindings(struct weston_compositor *compositor, uint32_t axis)
+{
+	struct weston_seat *seat = compositor->seat;
+	enum weston_keyboard_modifier modifier = seat->modifier_state;
+
+	count = 0;
+	seat->modifier_state = TEST_MODIFIER;
+	weston_compositor_run_axis_binding(compositor, seat, 0, axis,
+					   wl_fixed_from_int(1));
+	seat->modifier_state = modifier;
+}
+
+TEST(binding_order)
+{
+	struct weston_binding *b[3], *other;
+
+	/* Several bindings on one key run in the order they were added,
+	 * and a binding on another key in between doesn't run. */
+	b[0] = weston_compositor_add_key_binding(compositor, KEY_F1,
+						 TEST_MODIFIER, key_handler,
+						 (void *) 1);
+	other = weston_compositor_add_key_binding(compositor, KEY_F2,
+						  TEST_MODIFIER, key_handler,
+						  (void *) 9);
+	b[1] = weston_compositor_add_key_binding(compositor, KEY_F1,
+						 TEST_MODIFIER, key_handler,
+						 (void *) 2);
+	b[2] = weston_compositor_add_key_binding(compositor, KEY_F1,
+						 TEST_MODIFIER, key_handler,
+						 (void *) 3);
+
+	run_key_bindings(compositor, KEY_F1);
+	assert(count == 3);
+	assert(order[0] == 1 && order[1] == 2 && order[2] == 3);
+
+	/* Removing one keeps the others in order. */
+	weston_binding_destroy(b[1]);
+	run_key_bindings(compositor, KEY_F1);
+	assert(count == 2);
+	assert(order[0] == 1 && order[1] == 3);
+
+	run_key_bindings(compositor, KEY_F2);
+	assert(count == 1 && order[0] == 9);
+
+	weston_binding_destroy(b[0]);
+	weston_binding_destroy(b[2]);
+	run_key_bindings(compositor, KEY_F1);
+	assert(count == 0);
+
+	weston_binding_destroy(other);
+	run_key_bindings(compositor, KEY_F2);
+	assert(count == 0);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+TEST(binding_code_zero)
+{
+	struct weston_binding *key, *button, *axis, *f1;
+
+	/* Key, button and axis 0 are valid codes, and the tables are
+	 * separate, so each runs only its own binding. */
+	key = weston_compositor_add_key_binding(compositor, 0,
+						TEST_MODIFIER, key_handler,
+						(void *) 1);
+	f1 = weston_compositor_add_key_binding(compositor, KEY_F1,
+					       TEST_MODIFIER, key_handler,
+					       (void *) 4);
+	button = weston_compositor_add_button_binding(compositor, 0,
+						      TEST_MODIFIER,
+						      button_handler,
+						      (void *) 2);
+	axis = weston_compositor_add_axis_binding(compositor, 0,
+						  TEST_MODIFIER, axis_handler,
+						  (void *) 3);
+
+	run_key_bindings(compositor, 0);
+	assert(count == 1 && order[0] == 1);
+
+	run_button_bindings(compositor, 0);
+	assert(count == 1 && order[0] == 2);
+
+	run_axis_bindings(compositor, 0);
+	assert(count == 1 && order[0] == 3);
+
+	run_button_bindings(compositor, BTN_LEFT);
+	assert(count == 0);
+
+	weston_binding_destroy(key);
+	run_key_bindings(compositor, 0);
+	assert(count == 0);
+	run_key_bindings(compositor, KEY_F1);
+	assert(count == 1 && order[0] == 4);
+
+	weston_binding_destroy(f1);
+	weston_binding_destroy(button);
+	weston_binding_destroy(axis);
+
+	run_button_bindings(compositor, 0);
+	assert(count == 0);
+	run_axis_bindings(compositor, 0);
+	assert(count == 0);
+
+	wl_display_terminate(compositor->wl_display);
+}
@@ -30,54 +30,229 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include <cairo.h>
 
 #include "wcap-decode.h"
 
+typedef uint8_t v16u8 __attribute__ ((vector_size (16)));
+
+/* Frames with less damage than this are decoded on the calling
+ * thread; handing them to the workers costs more than it saves. */
+#define WCAP_THREAD_MIN_PIXELS	(256 * 256)
+#define WCAP_MAX_THREADS	8
+
+struct wcap_decoder_pool {
+	struct wcap_decoder *decoder;
+	pthread_t threads[WCAP_MAX_THREADS];
+	int nthreads;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond, done_cond;
+	uint32_t generation;
+	int quit;
+
+	struct wcap_rectangle *rects;
+	uint32_t **data;
+	uint32_t size, count, next, done;
+};
+
+/* Add the 0x00rrggbb delta to each of the n pixels at d, byte by
+ * byte, the way the encoder's component_delta() subtracted them. */
 static void
+apply_delta(uint32_t *d, int n, uint32_t delta)
+{
+	uint32_t lanes[4], v;
+	v16u8 vd, va, vp;
+	unsigned char r, g, b;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		lanes[i] = delta;
+	memcpy(&vd, lanes, sizeof vd);
+	for (i = 0; i < 4; i++)
+		lanes[i] = 0xff000000;
+	memcpy(&va, lanes, sizeof va);
+
+	while (n >= 4) {
+		memcpy(&vp, d, sizeof vp);
+		vp = (vp + vd) | va;
+		memcpy(d, &vp, sizeof vp);
+		d += 4;
+		n -= 4;
+	}
+
+	while (n > 0) {
+		v = *d;
+		r = (v >> 16) + (delta >> 16);
+		g = (v >>  8) + (delta >>  8);
+		b = (v >>  0) + (delta >>  0);
+		*d++ = 0xff000000 | (r << 16) | (g << 8) | b;
+		n--;
+	}
+}
+
+static inline int
+run_length(uint32_t v)
+{
+	int l = v >> 24;
+
+	if (l < 0xe0)
+		return l + 1;
+	else
+		return 1 << (l - 0xe0 + 7);
+}
+
+/* Return the end of the run-length encoded data of count pixels at p. */
+static uint32_t *
+skip_rectangle(uint32_t *p, int count)
+{
+	int i = 0;
+
+	while (i < count)
+		i += run_length(*p++);
+
+	return p;
+}
+
+static uint32_t *
 wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
-			      struct wcap_rectangle *rect)
+			      struct wcap_rectangle *rect, uint32_t *p)
 {
-	uint32_t v, *p = decoder->p, *d;
+	uint32_t v, *d;
 	int width = rect->x2 - rect->x1, height = rect->y2 - rect->y1;
-	int x, i, j, k, l, count = width * height;
-	unsigned char r, g, b, dr, dg, db;
+	int x, i, j, n, count = width * height;
 
 	d = decoder->frame + (rect->y2 - 1) * decoder->width;
 	x = rect->x1;
 	i = 0;
 	while (i < count) {
 		v = *p++;
-		l = v >> 24;
-		if (l < 0xe0) {
-			j = l + 1;
-		} else {
-			j = 1 << (l - 0xe0 + 7);
-		}
+		j = run_length(v);
+		i += j;
 
-		dr = (v >> 16);
-		dg = (v >>  8);
-		db = (v >>  0);
-		for (k = 0; k < j; k++) {
-			r = (d[x] >> 16) + dr;
-			g = (d[x] >>  8) + dg;
-			b = (d[x] >>  0) + db;
-			d[x] = 0xff000000 | (r << 16) | (g << 8) | b;
-			x++;
+		/* Split the run at row ends rather than checking for
+		 * the wrap on every pixel. */
+		while (j > 0) {
+			n = rect->x2 - x;
+			if (n > j)
+				n = j;
+			apply_delta(d + x, n, v & 0x00ffffff);
+			x += n;
+			j -= n;
 			if (x == rect->x2) {
 				x = rect->x1;
 				d -= decoder->width;
 			}
 		}
-		i += j;
 	}
 
 	if (i != count)
 		printf("rle encoding longer than expected (%d expected %d)\n",
 		       i, count);
 
+	return p;
+}
+
+static void
+wcap_decoder_run_jobs(struct wcap_decoder_pool *pool)
+{
+	struct wcap_decoder *decoder = pool->decoder;
+	uint32_t i;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->next < pool->count) {
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		wcap_decoder_decode_rectangle(decoder,
+					      &pool->rects[i], pool->data[i]);
+
+		pthread_mutex_lock(&pool->mutex);
+		pool->done++;
+		if (pool->done == pool->count)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static void *
+wcap_decoder_worker(void *data)
+{
+	struct wcap_decoder_pool *pool = data;
+	uint32_t generation = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+		if (pool->quit)
+			break;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		wcap_decoder_run_jobs(pool);
+
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/* Rectangles within a frame never overlap, so once we know where
+ * each one's data starts they can be decoded independently. */
+static int
+wcap_decoder_decode_parallel(struct wcap_decoder *decoder,
+			     struct wcap_rectangle *rects, uint32_t nrects)
+{
+	struct wcap_decoder_pool *pool = decoder->pool;
+	uint32_t i, **data, *p;
+	int pixels;
+
+	if (pool == NULL || nrects < 2)
+		return 0;
+
+	pixels = 0;
+	for (i = 0; i < nrects; i++)
+		pixels += (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+	if (pixels < WCAP_THREAD_MIN_PIXELS)
+		return 0;
+
+	if (nrects > pool->size) {
+		data = realloc(pool->data, nrects * sizeof *data);
+		if (data == NULL)
+			return 0;
+		pool->data = data;
+		pool->size = nrects;
+	}
+
+	p = decoder->p;
+	for (i = 0; i < nrects; i++) {
+		pool->data[i] = p;
+		p = skip_rectangle(p, (rects[i].x2 - rects[i].x1) *
+				   (rects[i].y2 - rects[i].y1));
+	}
 	decoder->p = p;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->rects = rects;
+	pool->count = nrects;
+	pool->next = 0;
+	pool->done = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	wcap_decoder_run_jobs(pool);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->done < pool->count)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return 1;
 }
 
 int
@@ -87,7 +262,6 @@ wcap_decoder_get_frame(struct wcap_decoder *decoder)
 	struct wcap_frame_header *header;
 	uint32_t *s;
 	uint32_t i;
-	int width, height;
 
 	if (decoder->p == decoder->end)
 		return 0;
@@ -97,16 +271,82 @@ wcap_decoder_get_frame(struct wcap_decoder *decoder)
 	decoder->count++;
 
 	rects = (void *) (header + 1);
+	decoder->rects = rects;
+	decoder->nrects = header->nrects;
 	decoder->p = (uint32_t *) (rects + header->nrects);
-	for (i = 0; i < header->nrects; i++) {
-		width = rects[i].x2 - rects[i].x1;
-		height = rects[i].y2 - rects[i].y1;
-		wcap_decoder_decode_rectangle(decoder, &rects[i]);
+	s = decoder->p;
+	if (!wcap_decoder_decode_parallel(decoder, rects, header->nrects)) {
+		for (i = 0; i < header->nrects; i++)
+			decoder->p =
+				wcap_decoder_decode_rectangle(decoder,
+							      &rects[i],
+							      decoder->p);
 	}
+	decoder->rle_size = ((uint32_t *) decoder->p - s) * 4;
 
 	return 1;
 }
 
+static void
+wcap_decoder_pool_destroy(struct wcap_decoder_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->data);
+	free(pool);
+}
+
+static struct wcap_decoder_pool *
+wcap_decoder_pool_create(struct wcap_decoder *decoder)
+{
+	struct wcap_decoder_pool *pool;
+	long ncpus;
+	int i;
+
+	/* The calling thread decodes too, so one worker per
+	 * additional cpu. */
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus < 2)
+		return NULL;
+
+	pool = malloc(sizeof *pool);
+	if (pool == NULL)
+		return NULL;
+
+	memset(pool, 0, sizeof *pool);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	/* The workers only ever see the pool; the caller sets
+	 * decoder->pool. */
+	pool->decoder = decoder;
+	for (i = 0; i < ncpus - 1 && i < WCAP_MAX_THREADS; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   wcap_decoder_worker, pool) != 0)
+			break;
+		pool->nthreads++;
+	}
+
+	if (pool->nthreads == 0) {
+		wcap_decoder_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
 struct wcap_decoder *
 wcap_decoder_create(const char *filename)
 {
@@ -131,6 +371,9 @@ wcap_decoder_create(const char *filename)
 	header = decoder->map;
 	decoder->format = header->format;
 	decoder->count = 0;
+	decoder->rects = NULL;
+	decoder->nrects = 0;
+	decoder->rle_size = 0;
 	decoder->width = header->width;
 	decoder->height = header->height;
 	decoder->p = header + 1;
@@ -140,12 +383,16 @@ wcap_decoder_create(const char *filename)
 	decoder->frame = malloc(frame_size);
 	memset(decoder->frame, 0, frame_size);
 
+	decoder->pool = wcap_decoder_pool_create(decoder);
+
 	return decoder;
 }
 
 void
 wcap_decoder_destroy(struct wcap_decoder *decoder)
 {
+	if (decoder->pool)
+		wcap_decoder_pool_destroy(decoder->pool);
 	munmap(decoder->map, decoder->size);
 	free(decoder->frame);
 	free(decoder);
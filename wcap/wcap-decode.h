@@ -45,6 +45,8 @@ struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
 
+struct wcap_decoder_pool;
+
 struct wcap_decoder {
 	int fd;
 	size_t size;
@@ -54,6 +56,14 @@ struct wcap_decoder {
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+
+	/* The rectangles of the last frame and the size of its
+	 * run-length encoded pixel data in bytes. */
+	struct wcap_rectangle *rects;
+	uint32_t nrects;
+	uint32_t rle_size;
+
+	struct wcap_decoder_pool *pool;
 };
 
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
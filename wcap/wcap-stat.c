@@ -0,0 +1,276 @@
+/*
+ * Copyright © 2026 agent
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "wcap-decode.h"
+
+/* Interval histogram buckets are 1ms wide, up to four target frame
+ * periods; anything longer goes into the last bucket. */
+#define INTERVAL_PERIODS	4
+
+/* Damaged area in tenths of the output area. */
+#define AREA_BUCKETS		10
+
+/* Rectangle counts in power of two buckets: 0, 1, 2, 3-4, 5-8, ... */
+#define RECT_BUCKETS		12
+
+struct frame_stats {
+	uint32_t msecs;
+	uint32_t interval;
+	uint32_t nrects;
+	uint32_t area;
+	uint32_t rle_size;
+};
+
+struct stats {
+	int target_fps;
+	uint32_t period;
+	int json;
+
+	int width, height;
+	uint32_t nframes, size;
+	struct frame_stats *frames;
+
+	uint32_t late, dropped;
+	uint32_t *interval_histogram;
+	uint32_t ninterval_buckets;
+	uint32_t area_histogram[AREA_BUCKETS];
+	uint32_t rect_histogram[RECT_BUCKETS];
+};
+
+static int
+rect_bucket(uint32_t nrects)
+{
+	int i;
+
+	if (nrects <= 1)
+		return nrects;
+
+	i = 33 - __builtin_clz(nrects - 1);
+
+	return i < RECT_BUCKETS ? i : RECT_BUCKETS - 1;
+}
+
+static uint32_t
+rect_bucket_min(int i)
+{
+	return i < 2 ? i : (1 << (i - 2)) + 1;
+}
+
+static void
+account_frame(struct stats *stats, struct wcap_decoder *decoder)
+{
+	struct frame_stats *f, *frames;
+	uint32_t i, area, total, bucket, missed;
+
+	if (stats->nframes == stats->size) {
+		stats->size = stats->size ? stats->size * 2 : 256;
+		frames = realloc(stats->frames,
+				 stats->size * sizeof *stats->frames);
+		if (frames == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		stats->frames = frames;
+	}
+
+	f = &stats->frames[stats->nframes];
+	f->msecs = decoder->msecs;
+	f->nrects = decoder->nrects;
+	f->rle_size = decoder->rle_size;
+
+	area = 0;
+	for (i = 0; i < decoder->nrects; i++)
+		area += (decoder->rects[i].x2 - decoder->rects[i].x1) *
+			(decoder->rects[i].y2 - decoder->rects[i].y1);
+	f->area = area;
+
+	total = decoder->width * decoder->height;
+	bucket = total ? (uint64_t) area * AREA_BUCKETS / total : 0;
+	if (bucket >= AREA_BUCKETS)
+		bucket = AREA_BUCKETS - 1;
+	stats->area_histogram[bucket]++;
+	stats->rect_histogram[rect_bucket(f->nrects)]++;
+
+	/* The first frame has nothing to measure against. */
+	if (stats->nframes == 0) {
+		f->interval = 0;
+		stats->nframes++;
+		return;
+	}
+
+	f->interval = f->msecs - stats->frames[stats->nframes - 1].msecs;
+	bucket = f->interval;
+	if (bucket >= stats->ninterval_buckets)
+		bucket = stats->ninterval_buckets - 1;
+	stats->interval_histogram[bucket]++;
+
+	/* A frame is late if it missed the vblank it should have made;
+	 * every whole period beyond that counts as a dropped frame. */
+	if (f->interval * stats->target_fps * 2 > 3000) {
+		missed = (f->interval * stats->target_fps + 500) / 1000;
+		stats->late++;
+		stats->dropped += missed - 1;
+	}
+
+	stats->nframes++;
+}
+
+static double
+ratio(struct frame_stats *f)
+{
+	return f->area ? (double) f->rle_size / (f->area * 4) : 0.0;
+}
+
+static void
+print_csv(struct stats *stats)
+{
+	struct frame_stats *f;
+	uint32_t i;
+
+	printf("frame,msecs,interval,nrects,area,rle_size,ratio\n");
+	for (i = 0; i < stats->nframes; i++) {
+		f = &stats->frames[i];
+		printf("%u,%u,%u,%u,%u,%u,%.4f\n",
+		       i, f->msecs, f->interval, f->nrects, f->area,
+		       f->rle_size, ratio(f));
+	}
+}
+
+static void
+print_json(struct stats *stats)
+{
+	struct frame_stats *f;
+	uint32_t i;
+	int j;
+
+	printf("{\n");
+	printf("  \"width\": %d,\n  \"height\": %d,\n",
+	       stats->width, stats->height);
+	printf("  \"target_fps\": %d,\n", stats->target_fps);
+	printf("  \"nframes\": %u,\n", stats->nframes);
+	printf("  \"late_frames\": %u,\n", stats->late);
+	printf("  \"dropped_frames\": %u,\n", stats->dropped);
+
+	printf("  \"interval_histogram\": [");
+	for (i = 0; i < stats->ninterval_buckets; i++)
+		printf("%s\n    { \"msecs\": %u, \"count\": %u }",
+		       i ? "," : "", i, stats->interval_histogram[i]);
+	printf("\n  ],\n");
+
+	printf("  \"area_histogram\": [");
+	for (j = 0; j < AREA_BUCKETS; j++)
+		printf("%s\n    { \"percent\": %d, \"count\": %u }",
+		       j ? "," : "", j * 100 / AREA_BUCKETS,
+		       stats->area_histogram[j]);
+	printf("\n  ],\n");
+
+	printf("  \"rect_histogram\": [");
+	for (j = 0; j < RECT_BUCKETS; j++)
+		printf("%s\n    { \"nrects\": %u, \"count\": %u }",
+		       j ? "," : "", rect_bucket_min(j),
+		       stats->rect_histogram[j]);
+	printf("\n  ],\n");
+
+	printf("  \"frames\": [");
+	for (i = 0; i < stats->nframes; i++) {
+		f = &stats->frames[i];
+		printf("%s\n    { \"msecs\": %u, \"interval\": %u, "
+		       "\"nrects\": %u, \"area\": %u, \"rle_size\": %u, "
+		       "\"ratio\": %.4f }",
+		       i ? "," : "", f->msecs, f->interval, f->nrects,
+		       f->area, f->rle_size, ratio(f));
+	}
+	printf("\n  ]\n}\n");
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"usage: wcap-stat [--fps=RATE] [--json] WCAP_FILE\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct wcap_decoder *decoder;
+	struct stats stats;
+	const char *filename = NULL;
+	int i;
+
+	memset(&stats, 0, sizeof stats);
+	stats.target_fps = 60;
+
+	for (i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--fps=", 6) == 0)
+			stats.target_fps = strtol(argv[i] + 6, NULL, 0);
+		else if (strcmp(argv[i], "--json") == 0)
+			stats.json = 1;
+		else if (filename == NULL)
+			filename = argv[i];
+		else
+			usage();
+	}
+
+	if (filename == NULL || stats.target_fps <= 0)
+		usage();
+
+	decoder = wcap_decoder_create(filename);
+	if (decoder == NULL) {
+		fprintf(stderr, "failed to open %s\n", filename);
+		return 1;
+	}
+
+	stats.width = decoder->width;
+	stats.height = decoder->height;
+	stats.period = 1000 / stats.target_fps;
+	if (stats.period == 0)
+		stats.period = 1;
+	stats.ninterval_buckets = stats.period * INTERVAL_PERIODS + 1;
+	stats.interval_histogram =
+		calloc(stats.ninterval_buckets,
+		       sizeof *stats.interval_histogram);
+	if (stats.interval_histogram == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	while (wcap_decoder_get_frame(decoder))
+		account_frame(&stats, decoder);
+
+	if (stats.json)
+		print_json(&stats);
+	else
+		print_csv(&stats);
+
+	free(stats.interval_histogram);
+	free(stats.frames);
+	wcap_decoder_destroy(decoder);
+
+	return 0;
+}